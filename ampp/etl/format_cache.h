@@ -0,0 +1,23 @@
+#pragma once
+
+namespace etl
+{
+
+// Trace formats harvested from PDBs, kept in a file so later runs skip
+// loading the PDBs that have not changed. The file is mapped when the cache
+// is created, a PDB is matched by its path, size, write time and signature.
+// Pass the cache to PdbProvider and call Save() once the providers are added.
+class FormatCache
+{
+  friend class PdbProvider;
+public:
+  class Impl;
+public:
+  explicit FormatCache(const fs::path &cacheFile);
+  ~FormatCache();
+  bool Save() const;
+private:
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace etl
@@ -1,15 +1,9 @@
 #pragma once
+#include <ampp/etl/trace_base.h>
 
 namespace etl
 {
 
-enum class Architecture
-{
-  Unknown,
-  X86,
-  X64
-};
-
 class PdbSymbol
 {
   friend class PdbSymbolAccessor;
@@ -5,12 +5,16 @@ namespace etl
 {
 
 class PdbFileManager;
+class FormatCache;
 
 class PdbProvider : public TraceProvider
 {
   class Impl;
 public:
   PdbProvider(const PdbFileManager &fm, const fs::path &pdbFile);
+  // PDBs the cache has formats for are not loaded, the others are harvested
+  // into it
+  PdbProvider(const PdbFileManager &fm, const fs::path &pdbFile, FormatCache &cache);
   ~PdbProvider();
   bool EnumerateTraces(const SourceFileCallback &, const TraceGuidCallback &) const override;
 private:
@@ -0,0 +1,26 @@
+#pragma once
+
+namespace etl
+{
+
+// Maps NTSTATUS/HRESULT codes to message text. Codes are resolved once and
+// the text is kept for the lifetime of the table, so returned references
+// stay valid. The table can be seeded from a file written by Save, which
+// allows decoding without the system message tables.
+class StatusMessageTable
+{
+  class Impl;
+public:
+  StatusMessageTable();
+  ~StatusMessageTable();
+  static StatusMessageTable &Default();
+  const std::wstring &Lookup(DWORD code) const;
+  void Add(DWORD code, const std::wstring &message);
+  bool Load(const fs::path &tablePath);
+  bool Save(const fs::path &tablePath) const;
+  void EnableSystemMessages(bool enable);
+private:
+  std::unique_ptr<Impl> impl_;
+};
+
+} // namespace etl
@@ -33,6 +33,11 @@ std::basic_string<CharT, TraitsT> &TrimR(std::basic_string<CharT, TraitsT> &s)
   return s;
 }
 
+// Appends UTF-8 text as UTF-16, malformed sequences become U+FFFD
+void AppendUtf8(std::wstring &out, const char *s, size_t length);
+// Appends UTF-16 text as UTF-8, unpaired surrogates become U+FFFD
+void AppendAsUtf8(std::string &out, const wchar_t *s, size_t length);
+
 void Skip(const wchar_t *&fmtLine, const wchar_t *endFmtLine, wchar_t ch);
 void SkipUntil(const wchar_t *&fmtLine, const wchar_t *endFmtLine, wchar_t ch);
 
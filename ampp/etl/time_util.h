@@ -7,6 +7,8 @@ FILETIME operator+(const FILETIME &lhs, const FILETIME &rhs);
 FILETIME GetCurrentLocalFileTime();
 
 int FileTimeCmp(const FILETIME &lhs, const FILETIME &rhs);
+std::uint64_t FileTimeToTicks(const FILETIME &ft);
+FILETIME TicksToFileTime(std::uint64_t ticks);
 
 std::wstring FormatFileTime(const wchar_t *fmt, const FILETIME &ft);
 std::optional<FILETIME> ParseFileTime(const wchar_t *fmt, const std::wstring &data);
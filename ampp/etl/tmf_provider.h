@@ -0,0 +1,21 @@
+#pragma once
+#include <ampp/etl/trace_base.h>
+
+namespace etl
+{
+
+// Formats from the .tmf files tracepdb writes, either a single file or every
+// .tmf file in a directory. TMF files do not tell whether the traces come from
+// 32 or 64 bit code, arch sets the size of pointer arguments.
+class TmfProvider : public TraceProvider
+{
+  class Impl;
+public:
+  explicit TmfProvider(const fs::path &tmfPath, Architecture arch = Architecture::X64);
+  ~TmfProvider();
+  bool EnumerateTraces(const SourceFileCallback &, const TraceGuidCallback &) const override;
+private:
+  std::unique_ptr<Impl> impl_;
+};
+
+} // namespace etl
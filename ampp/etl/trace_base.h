@@ -6,6 +6,13 @@ namespace etl
 struct TraceFormat;
 struct TraceFormatData;
 
+enum class Architecture
+{
+  Unknown,
+  X86,
+  X64
+};
+
 using TraceFormatAddCallback = std::function<void (const GUID &, const wchar_t *, TraceFormat &&)>;
 using ProviderCallback = std::function<bool (const TraceFormatAddCallback &)>;
 using SourceFileCallback = std::function<void(const GUID &, const ProviderCallback &)>;
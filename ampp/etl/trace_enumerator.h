@@ -20,12 +20,23 @@ public:
   void RemoveObserver(Observer *o) const;
   void NotifyObservers() const;
 private:
-  mutable std::list<Observer *> observers_;
+  struct Entry
+  {
+    Observer *observer;
+    // threads in the observer's Notify()
+    std::vector<std::thread::id> notifying;
+  };
+  mutable std::list<std::shared_ptr<Entry>> observers_;
+  mutable std::mutex lock_;
+  mutable std::condition_variable notified_;
 };
 
 namespace etl
 {
 
+// Safe to share between enumerators on different threads. Formats are
+// loaded from the providers on first use and stay valid as long as the
+// database.
 class FormatDatabase
 {
 public:
@@ -43,24 +54,175 @@ private:
   std::unique_ptr<Impl> impl_;
 };
 
+// Immediate formats every event as it arrives, Deferred leaves the message
+// unformatted until a filter, logger or GetItemValue needs it.
+enum class DecodeMode
+{
+  Immediate,
+  Deferred
+};
+
+// Limits on the events an enumerator keeps, zero means unlimited. The oldest
+// events are evicted a store chunk at a time once any limit is exceeded.
+struct RetentionPolicy
+{
+  size_t maxEvents;
+  size_t maxBytes;
+  DWORD maxAgeSeconds;
+  //
+  RetentionPolicy();
+};
+
+// Moves the oldest events to a memory mapped segment file in directory, the
+// temp directory if empty, once the events in memory take more than
+// maxResidentBytes. Zero keeps everything in memory. Spilled events are read
+// back on access and stay browsable and filterable.
+struct SpillPolicy
+{
+  fs::path directory;
+  size_t maxResidentBytes;
+  //
+  SpillPolicy();
+};
+
+// Change of the visible events since the previous update. inserted holds the
+// sorted index ranges [first, last) of new events in the current view. After
+// a reset, like a filter change or an eviction, the whole view has to be
+// reloaded and inserted is empty.
+struct CountUpdate
+{
+  size_t count;
+  std::vector<std::pair<size_t, size_t>> inserted;
+  bool reset;
+  //
+  CountUpdate();
+};
+
+// Coalesces count updates and delivers them from a notifier thread once
+// eventThreshold events are pending or intervalMilliseconds after the first
+// pending change, a zero disables that trigger. With both zero every change
+// is reported right away by the thread making it.
+struct NotifyPolicy
+{
+  DWORD intervalMilliseconds;
+  size_t eventThreshold;
+  //
+  NotifyPolicy();
+};
+
+// TimeStamp sorts the events of a view by time, Arrival keeps them in the
+// order they were read, which is the order of their TraceIndex
+enum class ViewOrder
+{
+  TimeStamp,
+  Arrival
+};
+
+// Field values of consecutive events of a view, all read from the same state
+// of the view. The values stay valid until the object is filled again or
+// destroyed, whatever happens to the events meanwhile. Reusing one object for
+// every screen avoids most allocations.
+class ItemValues
+{
+public:
+  class Impl;
+public:
+  ItemValues();
+  ~ItemValues();
+  size_t GetCount() const;
+  const wchar_t *GetValue(size_t index, size_t column, size_t *valueLength = nullptr) const;
+private:
+  friend class TraceView;
+  std::unique_ptr<Impl> impl_;
+};
+
+// A filtered list of the events of a TraceEnumerator. The views of one
+// enumerator share its events, decoded messages and item metadata, each has
+// its own filters, order and count notifications and is kept up to date as
+// events arrive. Indices are those of the view. A view has to be destroyed
+// before its enumerator.
+// Values returned by GetItemValue() live as long as their event. Once it is
+// evicted they stay readable until the view has reported the change and the
+// calling thread has asked for another value.
+// Filter callbacks are called by the threads adding events or changing the
+// filters, never by the worker pool and one at a time per view, possibly
+// with the enumerator locked. They must not call into the enumerator or its
+// views.
+class TraceView
+{
+public:
+  class Impl;
+  using CountCallback = std::function<void (size_t count)>;
+  using CountUpdateCallback = std::function<void (const CountUpdate &update)>;
+  using Filter = std::function<bool (TraceEventDataItem item, const std::wstring &txt)>;
+  using FilterId = size_t;
+  static const FilterId InvalidFilter = 0;
+public:
+  ~TraceView();
+  TraceView(const TraceView &) = delete;
+  TraceView &operator=(const TraceView &) = delete;
+  void SetCountCallback(const CountCallback &countCallback);
+  void SetCountUpdateCallback(const CountUpdateCallback &countUpdateCallback);
+  void SetNotifyPolicy(const NotifyPolicy &policy);
+  std::vector<size_t> FindText(const std::wstring &text, bool wholeWord = false) const;
+  FilterId AddFilter(const Filter &filter);
+  FilterId AddFilterExpression(const std::wstring &expression, std::wstring *error = nullptr);
+  bool RemoveFilter(FilterId id);
+  void RemoveAllFilters();
+  void ApplyFilters();
+  size_t GetItemCount() const;
+  size_t FindIndexAtTime(const FILETIME &timeStamp) const;
+  std::pair<size_t, size_t> GetTimeRange(const FILETIME &begin, const FILETIME &end) const;
+  const wchar_t *GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const;
+  const std::wstring &GetItemValue(size_t index, TraceEventDataItem item) const;
+  size_t GetItemValues(size_t first, size_t count, const std::vector<TraceEventDataItem> &items, ItemValues &values) const;
+  void *GetItemMetadata(size_t index);
+  bool SetItemMetadata(size_t index, void *metadata);
+private:
+  friend class TraceEnumerator;
+  explicit TraceView(const std::shared_ptr<Impl> &impl);
+private:
+  std::shared_ptr<Impl> impl_;
+};
+
+// The item and filter functions of the enumerator itself work on its default
+// view, further views are made with CreateView().
 class TraceEnumerator
 {
 public:
   class Impl;
   using LogCallback = std::function<void (const TraceEventData &evt)>;
-  using CountCallback = std::function<void (size_t count)>;
+  using CountCallback = TraceView::CountCallback;
+  using CountUpdateCallback = TraceView::CountUpdateCallback;
+  using Filter = TraceView::Filter;
+  using FilterId = TraceView::FilterId;
+  static const FilterId InvalidFilter = TraceView::InvalidFilter;
 public:
   TraceEnumerator(const FormatDatabase &db);
   ~TraceEnumerator();
+  std::unique_ptr<TraceView> CreateView(ViewOrder order = ViewOrder::TimeStamp);
+  TraceView &GetDefaultView();
   void SetLogFunction(const LogCallback &logger);
   void SetCountCallback(const CountCallback &countCallback);
-  void AddFilter(const std::function<bool (TraceEventDataItem item, const std::wstring &txt)> &filter);
+  void SetCountUpdateCallback(const CountUpdateCallback &countUpdateCallback);
+  void SetNotifyPolicy(const NotifyPolicy &policy);
+  void SetDecodeMode(DecodeMode mode);
+  void SetRetentionPolicy(const RetentionPolicy &policy);
+  void SetSpillPolicy(const SpillPolicy &policy);
+  void EnableTextIndex(bool enable);
+  std::vector<size_t> FindText(const std::wstring &text, bool wholeWord = false) const;
+  FilterId AddFilter(const Filter &filter);
+  FilterId AddFilterExpression(const std::wstring &expression, std::wstring *error = nullptr);
+  bool RemoveFilter(FilterId id);
   void RemoveAllFilters();
   void ApplyFilters();
   size_t GetItemCount() const;
+  size_t FindIndexAtTime(const FILETIME &timeStamp) const;
+  std::pair<size_t, size_t> GetTimeRange(const FILETIME &begin, const FILETIME &end) const;
   void RemoveAllItems();
   const wchar_t *GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const;
   const std::wstring &GetItemValue(size_t index, TraceEventDataItem item) const;
+  size_t GetItemValues(size_t first, size_t count, const std::vector<TraceEventDataItem> &items, ItemValues &values) const;
   void *GetItemMetadata(size_t index);
   bool SetItemMetadata(size_t index, void *metadata);
   void InjectItem(const FILETIME &timeStamp, const std::function<std::wstring(TraceEventDataItem item)> &itemValue);
@@ -68,6 +230,7 @@ public:
   virtual void Stop() = 0;
 protected:
   std::unique_ptr<Impl> impl_;
+  std::unique_ptr<TraceView> view_;
 };
 
 class LogfileEnumerator : public TraceEnumerator
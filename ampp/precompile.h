@@ -23,9 +23,12 @@
 #include <Windows.h>
 
 #include <vector>
+#include <algorithm>
+#include <array>
 #include <map>
 #include <set>
 #include <list>
+#include <deque>
 #include <string>
 #include <cstdint>
 #include <codecvt>
@@ -35,6 +38,11 @@
 #include <functional>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <shared_mutex>
+#include <atomic>
+#include <unordered_map>
 #include <optional>
 
 #ifndef AMPP_INTERNAL_BUILD
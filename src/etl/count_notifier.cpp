@@ -0,0 +1,278 @@
+#include "stdafx.h"
+#include "count_notifier.h"
+
+namespace etl
+{
+
+namespace
+{
+
+using IndexRange = std::pair<size_t, size_t>;
+
+// Records an event inserted at index. Ranges at or after it move up by one,
+// a range it falls into or ends right before it grows instead.
+void AddInserted(std::vector<IndexRange> &ranges, size_t index)
+{
+  auto it = std::lower_bound(ranges.begin(), ranges.end(), index, [](const IndexRange &r, size_t i) { return r.second < i; });
+  if(it != ranges.end() && it->first <= index)
+  {
+    ++it->second;
+  }
+  else
+  {
+    it = ranges.insert(it, IndexRange(index, index + 1));
+  }
+  for(++it; it != ranges.end(); ++it)
+  {
+    ++it->first;
+    ++it->second;
+  }
+}
+
+} // private namespace
+
+// The state the notifier thread works on. The thread shares it, so it can
+// outlive a notifier destroyed by the delivery the thread is making. Each
+// thread runs for one generation, stopping starts the next.
+class CountNotifier::Impl : public std::enable_shared_from_this<CountNotifier::Impl>
+{
+public:
+  explicit Impl(const Deliver &deliver);
+  void SetPolicy(const NotifyPolicy &policy);
+  void Inserted(size_t index, size_t count);
+  void Reset(size_t count);
+  void Post();
+  void Flush();
+  void Stop();
+  bool Take(CountUpdate &update);
+private:
+  bool Batching() const;
+  bool Due() const;
+  void Changed();
+  void Run(size_t generation);
+private:
+  Deliver deliver_;
+  NotifyPolicy policy_;
+  CountUpdate pending_;
+  size_t pendingEvents_;
+  bool changed_;
+  bool flush_;
+  size_t generation_;
+  std::chrono::steady_clock::time_point firstChange_;
+  std::unique_ptr<std::thread> thread_;
+  std::mutex lock_;
+  std::condition_variable wake_;
+};
+
+CountNotifier::Impl::Impl(const Deliver &deliver)
+  : deliver_(deliver)
+  , pendingEvents_(0)
+  , changed_(false)
+  , flush_(false)
+  , generation_(0)
+{
+}
+
+// Pending changes carry over to the new policy
+void CountNotifier::Impl::SetPolicy(const NotifyPolicy &policy)
+{
+  Stop();
+  std::lock_guard<std::mutex> l(lock_);
+  policy_ = policy;
+  if(Batching())
+  {
+    auto self = shared_from_this();
+    const auto generation = generation_;
+    thread_ = std::make_unique<std::thread>([self, generation]() { self->Run(generation); });
+  }
+}
+
+void CountNotifier::Impl::Inserted(size_t index, size_t count)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  pending_.count = count;
+  ++pendingEvents_;
+  // a reset reloads everything anyway
+  if(!pending_.reset)
+  {
+    AddInserted(pending_.inserted, index);
+  }
+  Changed();
+}
+
+void CountNotifier::Impl::Reset(size_t count)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  pending_.count = count;
+  pending_.reset = true;
+  pending_.inserted.clear();
+  Changed();
+}
+
+// Delivers the pending change on the calling thread unless batching
+void CountNotifier::Impl::Post()
+{
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    if(Batching() || !changed_)
+    {
+      return;
+    }
+  }
+  deliver_();
+}
+
+// Has the notifier thread deliver the pending change without waiting for
+// the interval, e.g. once a log file has been read
+void CountNotifier::Impl::Flush()
+{
+  std::lock_guard<std::mutex> l(lock_);
+  if(changed_)
+  {
+    flush_ = true;
+    wake_.notify_one();
+  }
+}
+
+// Called from a delivery on the notifier thread, the thread is detached
+// rather than joined and ends once that delivery returns
+void CountNotifier::Impl::Stop()
+{
+  std::unique_ptr<std::thread> thread;
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    ++generation_;
+    thread = std::move(thread_);
+  }
+  if(!thread)
+  {
+    return;
+  }
+  wake_.notify_all();
+  if(thread->get_id() == std::this_thread::get_id())
+  {
+    thread->detach();
+  }
+  else
+  {
+    thread->join();
+  }
+}
+
+bool CountNotifier::Impl::Batching() const
+{
+  return policy_.intervalMilliseconds || policy_.eventThreshold;
+}
+
+bool CountNotifier::Impl::Due() const
+{
+  if(policy_.eventThreshold && pendingEvents_ >= policy_.eventThreshold)
+  {
+    return true;
+  }
+  return policy_.intervalMilliseconds
+    && std::chrono::steady_clock::now() - firstChange_ >= std::chrono::milliseconds(policy_.intervalMilliseconds);
+}
+
+// The thread only needs waking for the first change, which starts the
+// interval, and when the threshold is reached
+void CountNotifier::Impl::Changed()
+{
+  if(!changed_)
+  {
+    changed_ = true;
+    firstChange_ = std::chrono::steady_clock::now();
+    wake_.notify_one();
+  }
+  else if(pendingEvents_ == policy_.eventThreshold)
+  {
+    wake_.notify_one();
+  }
+}
+
+// Moves the pending change to update, false if another delivery took it
+bool CountNotifier::Impl::Take(CountUpdate &update)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  if(!changed_)
+  {
+    return false;
+  }
+  update = std::move(pending_);
+  pending_ = CountUpdate();
+  pendingEvents_ = 0;
+  changed_ = false;
+  flush_ = false;
+  return true;
+}
+
+void CountNotifier::Impl::Run(size_t generation)
+{
+  std::unique_lock<std::mutex> l(lock_);
+  while(generation == generation_)
+  {
+    if(changed_ && (flush_ || Due()))
+    {
+      l.unlock();
+      deliver_();
+      l.lock();
+    }
+    else if(changed_ && policy_.intervalMilliseconds)
+    {
+      wake_.wait_until(l, firstChange_ + std::chrono::milliseconds(policy_.intervalMilliseconds));
+    }
+    else
+    {
+      wake_.wait(l);
+    }
+  }
+}
+
+//////////////////////
+
+CountNotifier::CountNotifier(const Deliver &deliver)
+  : impl_(std::make_shared<Impl>(deliver))
+{
+}
+
+CountNotifier::~CountNotifier()
+{
+  impl_->Stop();
+}
+
+void CountNotifier::SetPolicy(const NotifyPolicy &policy)
+{
+  impl_->SetPolicy(policy);
+}
+
+void CountNotifier::Inserted(size_t index, size_t count)
+{
+  impl_->Inserted(index, count);
+}
+
+void CountNotifier::Reset(size_t count)
+{
+  impl_->Reset(count);
+}
+
+void CountNotifier::Post()
+{
+  impl_->Post();
+}
+
+void CountNotifier::Flush()
+{
+  impl_->Flush();
+}
+
+void CountNotifier::Stop()
+{
+  impl_->Stop();
+}
+
+bool CountNotifier::Take(CountUpdate &update)
+{
+  return impl_->Take(update);
+}
+
+} // namespace etl
@@ -0,0 +1,36 @@
+#pragma once
+#include <ampp/etl/trace_enumerator.h>
+
+namespace etl
+{
+
+// Collects changes of the visible events and has the owner deliver them,
+// either right away from Post() or coalesced from its own thread as the
+// policy says. Changes are recorded under the owner's lock so the index
+// ranges follow the order the events were inserted in, Post() is called after
+// releasing it. The owner takes the change under its lock again, together
+// with the state it publishes.
+// The notifier may be stopped or destroyed from its own thread, by a
+// callback it delivers. The thread then finishes that delivery on its own.
+class CountNotifier
+{
+public:
+  class Impl;
+  using Deliver = std::function<void ()>;
+  //
+  explicit CountNotifier(const Deliver &deliver);
+  ~CountNotifier();
+  CountNotifier(const CountNotifier &) = delete;
+  CountNotifier &operator=(const CountNotifier &) = delete;
+  void SetPolicy(const NotifyPolicy &policy);
+  void Inserted(size_t index, size_t count);
+  void Reset(size_t count);
+  void Post();
+  void Flush();
+  void Stop();
+  bool Take(CountUpdate &update);
+private:
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace etl
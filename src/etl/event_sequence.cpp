@@ -0,0 +1,405 @@
+#include "stdafx.h"
+#include "event_sequence.h"
+
+namespace etl
+{
+
+namespace
+{
+
+std::shared_ptr<SequenceGroup> MakeGroup()
+{
+  auto group = std::make_shared<SequenceGroup>();
+  group->blocks.reserve(EventSequence::GroupSize);
+  group->starts.reserve(EventSequence::GroupSize);
+  return group;
+}
+
+size_t GroupRows(const SequenceGroup &group)
+{
+  return group.starts.back() + group.blocks.back()->size();
+}
+
+} // private namespace
+
+SequenceView::SequenceView()
+  : order_(ViewOrder::TimeStamp)
+  , groups_(0)
+  , size_(0)
+{
+}
+
+size_t SequenceView::Size() const
+{
+  return size_;
+}
+
+bool SequenceView::Empty() const
+{
+  return size_ == 0;
+}
+
+EventRow SequenceView::operator[](size_t index) const
+{
+  // the last block is where readers of a growing session usually are
+  auto starts = table_->starts.data();
+  auto group = groups_ - 1;
+  if(index < starts[group])
+  {
+    group = std::upper_bound(starts, starts + groups_, index) - starts - 1;
+  }
+  auto &blocks = Group(group);
+  const auto local = index - starts[group];
+  auto block = blocks.blocks.size() - 1;
+  if(local < blocks.starts[block])
+  {
+    block = std::upper_bound(blocks.starts.begin(), blocks.starts.end(), local) - blocks.starts.begin() - 1;
+  }
+  return BlockRows(group, block)[local - blocks.starts[block]];
+}
+
+// A group a view holds is not changed any more, the sequence copies it first,
+// but the table may still get groups appended, so it is read through data()
+const SequenceGroup &SequenceView::Group(size_t group) const
+{
+  return *table_->groups.data()[group];
+}
+
+// The last block may still be appended to, so it is read through data() and
+// sizes come from the view
+const EventRow *SequenceView::BlockRows(size_t group, size_t block) const
+{
+  return Group(group).blocks[block]->data();
+}
+
+size_t SequenceView::BlockLength(size_t group, size_t block) const
+{
+  auto &g = Group(group);
+  if(block + 1 < g.blocks.size())
+  {
+    return g.starts[block + 1] - g.starts[block];
+  }
+  auto starts = table_->starts.data();
+  return (group + 1 < groups_ ? starts[group + 1] : size_) - starts[group] - g.starts[block];
+}
+
+size_t SequenceView::Start(size_t group, size_t block) const
+{
+  return table_->starts.data()[group] + Group(group).starts[block];
+}
+
+//////////////////////
+
+EventSequence::EventSequence(ViewOrder order)
+  : order_(order)
+  , table_(std::make_shared<SequenceTable>())
+  , size_(0)
+{
+}
+
+ViewOrder EventSequence::Order() const
+{
+  return order_;
+}
+
+size_t EventSequence::Size() const
+{
+  return size_;
+}
+
+bool EventSequence::Empty() const
+{
+  return size_ == 0;
+}
+
+// Views taken before keep the old rows
+void EventSequence::Clear()
+{
+  table_ = std::make_shared<SequenceTable>();
+  size_ = 0;
+}
+
+EventRow EventSequence::operator[](size_t index) const
+{
+  return View()[index];
+}
+
+// Removes up to count rows numbered below end. Those are the earliest
+// arrivals, so the scan almost always stops within the first blocks. Only
+// blocks that lose rows are copied.
+void EventSequence::RemoveBefore(EventRow end, size_t count)
+{
+  if(!count)
+  {
+    return;
+  }
+  auto below = [end](EventRow r) { return r < end; };
+  auto &table = Table(false);
+  size_t removed = 0;
+  for(size_t g = 0; g < table.groups.size() && removed < count; ++g)
+  {
+    bool changed = false;
+    for(size_t b = 0; b < table.groups[g]->blocks.size() && removed < count; ++b)
+    {
+      auto &rows = *table.groups[g]->blocks[b];
+      if(std::none_of(rows.begin(), rows.end(), below))
+      {
+        continue;
+      }
+      WritableGroup(g);
+      auto &block = WritableBlock(g, b);
+      auto it = std::remove_if(block.begin(), block.end(), below);
+      removed += block.end() - it;
+      block.erase(it, block.end());
+      changed = true;
+    }
+    if(changed)
+    {
+      auto &group = *table.groups[g];
+      auto empty = [](const std::shared_ptr<SequenceBlock> &block) { return block->empty(); };
+      group.blocks.erase(std::remove_if(group.blocks.begin(), group.blocks.end(), empty), group.blocks.end());
+      group.starts.resize(group.blocks.size());
+      if(!group.blocks.empty())
+      {
+        group.starts[0] = 0;
+        UpdateStarts(g, 1);
+      }
+    }
+  }
+  if(!removed)
+  {
+    return;
+  }
+  table.groups.erase(std::remove_if(table.groups.begin(), table.groups.end(), [](const std::shared_ptr<SequenceGroup> &group) { return group->blocks.empty(); }), table.groups.end());
+  table.starts.resize(table.groups.size());
+  if(!table.starts.empty())
+  {
+    table.starts[0] = 0;
+    UpdateGroupStarts(1);
+  }
+  size_ -= removed;
+}
+
+std::vector<const SequenceBlock *> EventSequence::Blocks() const
+{
+  std::vector<const SequenceBlock *> rv;
+  for(auto &&group : table_->groups)
+  {
+    for(auto &&block : group->blocks)
+    {
+      rv.push_back(block.get());
+    }
+  }
+  return rv;
+}
+
+SequenceView EventSequence::View() const
+{
+  SequenceView rv;
+  rv.order_ = order_;
+  rv.table_ = table_;
+  rv.groups_ = table_->groups.size();
+  rv.size_ = size_;
+  return rv;
+}
+
+void EventSequence::PushBack(EventRow row)
+{
+  if(table_->groups.empty() || table_->groups.back()->blocks.back()->size() >= BlockSize)
+  {
+    auto block = std::make_shared<SequenceBlock>();
+    block->reserve(BlockSize);
+    if(table_->groups.empty() || table_->groups.back()->blocks.size() >= GroupSize)
+    {
+      auto group = MakeGroup();
+      group->blocks.push_back(std::move(block));
+      group->starts.push_back(0);
+      auto &table = Table(true);
+      table.groups.push_back(std::move(group));
+      table.starts.push_back(size_);
+    }
+    else
+    {
+      Table(false);
+      auto &group = WritableGroup(table_->groups.size() - 1);
+      group.blocks.push_back(std::move(block));
+      group.starts.push_back(size_ - table_->starts.back());
+    }
+  }
+  auto last = table_->groups.back()->blocks.back().get();
+  if(last->size() == last->capacity())
+  {
+    Table(false);
+    const auto group = table_->groups.size() - 1;
+    last = &WritableBlock(group, WritableGroup(group).blocks.size() - 1);
+  }
+  last->push_back(row);
+  ++size_;
+}
+
+// Returns the index the row was inserted at
+size_t EventSequence::Insert(EventRow row, const TraceEventStore &store)
+{
+  const auto key = Key(row, store);
+  if(table_->groups.empty() || Key(table_->groups.back()->blocks.back()->back(), store) <= key)
+  {
+    PushBack(row);
+    return size_ - 1;
+  }
+  auto &table = Table(false);
+  // the row goes after every row with the same or an earlier key, so pick
+  // the last group and block that start at or before it
+  auto git = std::upper_bound(table.groups.begin(), table.groups.end(), key,
+    [this, &store](std::uint64_t k, const std::shared_ptr<SequenceGroup> &group)
+    {
+      return k < Key(group->blocks.front()->front(), store);
+    });
+  if(git != table.groups.begin())
+  {
+    --git;
+  }
+  const auto groupIndex = static_cast<size_t>(git - table.groups.begin());
+  auto &group = WritableGroup(groupIndex);
+  auto bit = std::upper_bound(group.blocks.begin(), group.blocks.end(), key,
+    [this, &store](std::uint64_t k, const std::shared_ptr<SequenceBlock> &block)
+    {
+      return k < Key(block->front(), store);
+    });
+  if(bit != group.blocks.begin())
+  {
+    --bit;
+  }
+  const auto blockIndex = static_cast<size_t>(bit - group.blocks.begin());
+  auto &block = WritableBlock(groupIndex, blockIndex);
+  auto pos = std::upper_bound(block.begin(), block.end(), key,
+    [this, &store](std::uint64_t k, EventRow r)
+    {
+      return k < Key(r, store);
+    });
+  const auto index = table.starts[groupIndex] + group.starts[blockIndex] + (pos - block.begin());
+  block.insert(pos, row);
+  ++size_;
+  if(block.size() >= 2 * BlockSize)
+  {
+    SplitBlock(groupIndex, blockIndex);
+  }
+  UpdateStarts(groupIndex, blockIndex + 1);
+  UpdateGroupStarts(groupIndex + 1);
+  if(group.blocks.size() >= GroupSize)
+  {
+    SplitGroup(groupIndex);
+  }
+  return index;
+}
+
+size_t EventSequence::LowerBound(std::uint64_t timeStamp, const TraceEventStore &store) const
+{
+  return View().LowerBound(timeStamp, store);
+}
+
+// Index of row, or Size() when the row is not part of the sequence
+size_t EventSequence::Find(EventRow row, const TraceEventStore &store) const
+{
+  return View().Find(row, store);
+}
+
+std::uint64_t EventSequence::Key(EventRow row, const TraceEventStore &store) const
+{
+  return order_ == ViewOrder::Arrival ? row : store.TimeStamp(row);
+}
+
+// The table to change. A table shared with views is copied first, unless
+// groups are only appended and there is room for them.
+SequenceTable &EventSequence::Table(bool append)
+{
+  auto &table = *table_;
+  if(table_.use_count() == 1 || (append && table.groups.size() < table.groups.capacity() && table.starts.size() < table.starts.capacity()))
+  {
+    return table;
+  }
+  auto copy = std::make_shared<SequenceTable>();
+  copy->groups.reserve(2 * table.groups.size() + 1);
+  copy->groups.insert(copy->groups.end(), table.groups.begin(), table.groups.end());
+  copy->starts.reserve(2 * table.starts.size() + 1);
+  copy->starts.insert(copy->starts.end(), table.starts.begin(), table.starts.end());
+  table_ = std::move(copy);
+  return *table_;
+}
+
+// A group to change, copied first if a view still uses it. The table has to
+// be writable already.
+SequenceGroup &EventSequence::WritableGroup(size_t group)
+{
+  auto &ptr = table_->groups[group];
+  if(ptr.use_count() > 1)
+  {
+    auto copy = MakeGroup();
+    copy->blocks.assign(ptr->blocks.begin(), ptr->blocks.end());
+    copy->starts.assign(ptr->starts.begin(), ptr->starts.end());
+    ptr = std::move(copy);
+  }
+  return *ptr;
+}
+
+// A block to change in place, copied first if a view still uses it. Its
+// group has to be writable already.
+SequenceBlock &EventSequence::WritableBlock(size_t group, size_t block)
+{
+  auto &ptr = table_->groups[group]->blocks[block];
+  if(ptr.use_count() > 1)
+  {
+    auto copy = std::make_shared<SequenceBlock>();
+    copy->reserve((std::max)(ptr->size() + 1, BlockSize));
+    copy->assign(ptr->begin(), ptr->end());
+    ptr = std::move(copy);
+  }
+  return *ptr;
+}
+
+void EventSequence::SplitBlock(size_t group, size_t block)
+{
+  auto &g = *table_->groups[group];
+  auto &full = *g.blocks[block];
+  auto tail = std::make_shared<SequenceBlock>(full.begin() + BlockSize, full.end());
+  full.resize(BlockSize);
+  g.blocks.insert(g.blocks.begin() + block + 1, std::move(tail));
+  g.starts.insert(g.starts.begin() + block + 1, 0);
+}
+
+// Moves the second half of a full group into a new one after it
+void EventSequence::SplitGroup(size_t group)
+{
+  auto &full = *table_->groups[group];
+  const auto half = full.blocks.size() / 2;
+  const auto offset = full.starts[half];
+  auto tail = MakeGroup();
+  tail->blocks.assign(full.blocks.begin() + half, full.blocks.end());
+  for(auto i = half; i < full.starts.size(); ++i)
+  {
+    tail->starts.push_back(full.starts[i] - offset);
+  }
+  full.blocks.resize(half);
+  full.starts.resize(half);
+  table_->groups.insert(table_->groups.begin() + group + 1, std::move(tail));
+  table_->starts.insert(table_->starts.begin() + group + 1, table_->starts[group] + offset);
+}
+
+void EventSequence::UpdateStarts(size_t group, size_t firstBlock)
+{
+  auto &g = *table_->groups[group];
+  for(auto i = firstBlock; i < g.blocks.size(); ++i)
+  {
+    g.starts[i] = g.starts[i - 1] + g.blocks[i - 1]->size();
+  }
+}
+
+void EventSequence::UpdateGroupStarts(size_t firstGroup)
+{
+  auto &table = *table_;
+  for(auto i = firstGroup; i < table.groups.size(); ++i)
+  {
+    table.starts[i] = table.starts[i - 1] + GroupRows(*table.groups[i - 1]);
+  }
+}
+
+} // namespace etl
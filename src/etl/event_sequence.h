@@ -0,0 +1,195 @@
+#pragma once
+#include <ampp/etl/trace_enumerator.h>
+#include "trace_event_store.h"
+
+namespace etl
+{
+
+using SequenceBlock = std::vector<EventRow>;
+
+// Consecutive blocks of an EventSequence and the index of their first rows
+// within the group
+struct SequenceGroup
+{
+  std::vector<std::shared_ptr<SequenceBlock>> blocks;
+  std::vector<size_t> starts;
+};
+
+// The groups of an EventSequence and the index of their first rows. Views
+// share the table, its groups and blocks with the sequence, which copies
+// what it changes while they are shared, so a change copies the table, one
+// group and one block at most. Only appending rows or groups within reserved
+// space is done in place, a view never looks past its own size.
+struct SequenceTable
+{
+  std::vector<std::shared_ptr<SequenceGroup>> groups;
+  std::vector<size_t> starts;
+};
+
+// Read only state of an EventSequence at one point in time. It can be used
+// without the owner's lock and does not change with the sequence.
+class SequenceView
+{
+public:
+  SequenceView();
+  size_t Size() const;
+  bool Empty() const;
+  EventRow operator[](size_t index) const;
+  template <class Store>
+  size_t LowerBound(std::uint64_t timeStamp, const Store &store) const;
+  template <class KeyOf>
+  size_t LowerBoundBy(std::uint64_t key, KeyOf &&keyOf) const;
+  template <class Store>
+  size_t Find(EventRow row, const Store &store) const;
+  template <class F>
+  void ForEach(F &&f) const;
+private:
+  friend class EventSequence;
+  const SequenceGroup &Group(size_t group) const;
+  const EventRow *BlockRows(size_t group, size_t block) const;
+  size_t BlockLength(size_t group, size_t block) const;
+  size_t Start(size_t group, size_t block) const;
+private:
+  ViewOrder order_;
+  std::shared_ptr<const SequenceTable> table_;
+  size_t groups_;
+  size_t size_;
+};
+
+// Rows ordered by timestamp, or by row number in arrival order. The rows are
+// kept in bounded blocks, and the blocks in bounded groups, so an event
+// arriving out of order only shifts the rows of one block and the blocks of
+// one group. Events arriving in order are appended without searching.
+class EventSequence
+{
+public:
+  static const size_t BlockSize = 4096;
+  static const size_t GroupSize = 128;
+  //
+  explicit EventSequence(ViewOrder order = ViewOrder::TimeStamp);
+  ViewOrder Order() const;
+  size_t Size() const;
+  bool Empty() const;
+  void Clear();
+  EventRow operator[](size_t index) const;
+  size_t Insert(EventRow row, const TraceEventStore &store);
+  size_t LowerBound(std::uint64_t timeStamp, const TraceEventStore &store) const;
+  size_t Find(EventRow row, const TraceEventStore &store) const;
+  void PushBack(EventRow row);
+  void RemoveBefore(EventRow end, size_t count);
+  std::vector<const SequenceBlock *> Blocks() const;
+  SequenceView View() const;
+private:
+  std::uint64_t Key(EventRow row, const TraceEventStore &store) const;
+  SequenceTable &Table(bool append);
+  SequenceGroup &WritableGroup(size_t group);
+  SequenceBlock &WritableBlock(size_t group, size_t block);
+  void SplitBlock(size_t group, size_t block);
+  void SplitGroup(size_t group);
+  void UpdateStarts(size_t group, size_t firstBlock);
+  void UpdateGroupStarts(size_t firstGroup);
+private:
+  ViewOrder order_;
+  std::shared_ptr<SequenceTable> table_;
+  size_t size_;
+};
+
+// Index of the first row not earlier than timeStamp, Size() if there is none.
+// Rows in arrival order are only roughly ordered by time, the index is then
+// one where the time stamps cross it.
+template <class Store>
+size_t SequenceView::LowerBound(std::uint64_t timeStamp, const Store &store) const
+{
+  return LowerBoundBy(timeStamp, [&store](EventRow r) { return store.TimeStamp(r); });
+}
+
+// Index of the first row whose key is not below key, the rows have to be
+// ordered by it
+template <class KeyOf>
+size_t SequenceView::LowerBoundBy(std::uint64_t key, KeyOf &&keyOf) const
+{
+  auto endsBelow = [this, &keyOf, key](size_t group, size_t block)
+  {
+    return keyOf(BlockRows(group, block)[BlockLength(group, block) - 1]) < key;
+  };
+  size_t first = 0;
+  size_t last = groups_;
+  while(first < last)
+  {
+    const auto mid = first + (last - first) / 2;
+    if(endsBelow(mid, Group(mid).blocks.size() - 1))
+    {
+      first = mid + 1;
+    }
+    else
+    {
+      last = mid;
+    }
+  }
+  if(first == groups_)
+  {
+    return size_;
+  }
+  const auto group = first;
+  first = 0;
+  last = Group(group).blocks.size();
+  while(first < last)
+  {
+    const auto mid = first + (last - first) / 2;
+    if(endsBelow(group, mid))
+    {
+      first = mid + 1;
+    }
+    else
+    {
+      last = mid;
+    }
+  }
+  auto rows = BlockRows(group, first);
+  auto pos = std::lower_bound(rows, rows + BlockLength(group, first), key,
+    [&keyOf](EventRow r, std::uint64_t k)
+    {
+      return keyOf(r) < k;
+    });
+  return Start(group, first) + (pos - rows);
+}
+
+// Index of row, or Size() when the view does not hold it. The row has to be
+// readable from store.
+template <class Store>
+size_t SequenceView::Find(EventRow row, const Store &store) const
+{
+  auto keyOf = [this, &store](EventRow r) { return order_ == ViewOrder::Arrival ? r : store.TimeStamp(r); };
+  const auto key = keyOf(row);
+  for(auto index = LowerBoundBy(key, keyOf); index < size_; ++index)
+  {
+    auto cur = (*this)[index];
+    if(cur == row)
+    {
+      return index;
+    }
+    if(keyOf(cur) != key)
+    {
+      break;
+    }
+  }
+  return size_;
+}
+
+template <class F>
+void SequenceView::ForEach(F &&f) const
+{
+  for(size_t group = 0; group < groups_; ++group)
+  {
+    for(size_t block = 0, blocks = Group(group).blocks.size(); block < blocks; ++block)
+    {
+      auto rows = BlockRows(group, block);
+      for(size_t i = 0, length = BlockLength(group, block); i < length; ++i)
+      {
+        f(rows[i]);
+      }
+    }
+  }
+}
+
+} // namespace etl
@@ -0,0 +1,64 @@
+#include "stdafx.h"
+#include "file_util.h"
+
+namespace etl
+{
+
+bool WriteWholeFile(const fs::path &filePath, const void *data, size_t size)
+{
+  auto h = CreateFileW(filePath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr);
+  if (h == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  auto cur = static_cast<const std::uint8_t *>(data);
+  while (size > 0)
+  {
+    DWORD chunk = static_cast<DWORD>(__min(size, static_cast<size_t>(0x40000000)));
+    DWORD written = 0;
+    if (!WriteFile(h, cur, chunk, &written, nullptr) || written == 0)
+    {
+      CloseHandle(h);
+      return false;
+    }
+    cur += written;
+    size -= written;
+  }
+  CloseHandle(h);
+  return true;
+}
+
+// Maps a file for reading, it stays mapped as long as the returned pointer or
+// a copy of it is held. Others may rename the file meanwhile. Empty files are
+// not mapped.
+std::shared_ptr<const std::uint8_t> MapWholeFile(const fs::path &filePath, size_t &size)
+{
+  size = 0;
+  auto h = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr);
+  if (h == INVALID_HANDLE_VALUE)
+  {
+    return nullptr;
+  }
+  LARGE_INTEGER fileSize;
+  HANDLE mapping = nullptr;
+  if (GetFileSizeEx(h, &fileSize) && fileSize.QuadPart > 0)
+  {
+    mapping = CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  }
+  // the view keeps the file open on its own
+  CloseHandle(h);
+  if (!mapping)
+  {
+    return nullptr;
+  }
+  auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!view)
+  {
+    return nullptr;
+  }
+  size = static_cast<size_t>(fileSize.QuadPart);
+  return std::shared_ptr<const std::uint8_t>(static_cast<const std::uint8_t *>(view), [](const std::uint8_t *p) { UnmapViewOfFile(p); });
+}
+
+} // namespace etl
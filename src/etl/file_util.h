@@ -0,0 +1,35 @@
+#pragma once
+
+namespace etl
+{
+
+template <class CharT>
+std::vector<CharT> ReadWholeFile(const fs::path &filePath)
+{
+  std::vector<CharT> data;
+  auto h = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+  if (h == INVALID_HANDLE_VALUE)
+  {
+    return data;
+  }
+  auto fileSize = GetFileSize(h, nullptr);
+  if (fileSize == 0)
+  {
+    CloseHandle(h);
+    return data;
+  }
+  data.resize((fileSize + (sizeof(CharT) - 1)) / sizeof(CharT));
+  if (!ReadFile(h, &data[0], fileSize, &fileSize, nullptr))
+  {
+    CloseHandle(h);
+    data.clear();
+    return data;
+  }
+  CloseHandle(h);
+  return data;
+}
+
+bool WriteWholeFile(const fs::path &filePath, const void *data, size_t size);
+std::shared_ptr<const std::uint8_t> MapWholeFile(const fs::path &filePath, size_t &size);
+
+} // namespace etl
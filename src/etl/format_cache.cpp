@@ -0,0 +1,595 @@
+#include "stdafx.h"
+#include "format_cache_impl.h"
+#include "file_util.h"
+
+namespace etl
+{
+
+namespace
+{
+
+const char CacheMagic[8] = {'A', 'M', 'P', 'F', 'M', 'T', 'C', '\0'};
+const std::uint32_t CacheVersion = 1;
+
+// The cache file is this header followed by the records, each a multiple of
+// 8 bytes long
+struct CacheHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t recordCount;
+};
+
+// Offsets are from the start of the record. A string is its length followed
+// by the characters and a terminating zero.
+struct RecordHeader
+{
+  std::uint32_t size;
+  std::uint32_t pdbPath;
+  std::uint64_t fileSize;
+  std::uint64_t writeTime;
+  GUID signature;
+  std::uint32_t age;
+  std::uint32_t traceGuidCount;
+  std::uint32_t traceGuids;
+  std::uint32_t sourceFileCount;
+  std::uint32_t sourceFiles;
+};
+
+// Sorted by GUID, the formats of one file are stored together
+struct SourceFileEntry
+{
+  GUID fileGuid;
+  std::uint32_t formatCount;
+  std::uint32_t formats;
+};
+
+struct FormatEntry
+{
+  std::uint32_t sourcePath;
+  std::uint32_t moduleName;
+  std::uint32_t function;
+  std::uint32_t formatString;
+  std::uint32_t traceIndex;
+  std::uint32_t lineNumber;
+  std::uint32_t traceLevel;
+  std::uint32_t flags;
+  std::uint32_t fileInfoFlags;
+  std::uint32_t typeCount;
+  std::uint32_t types;
+  std::uint32_t configCount;
+  std::uint32_t configs;
+};
+
+struct TypeEntry
+{
+  std::uint32_t key;
+  std::uint32_t type;
+  std::uint32_t argName;
+};
+
+struct ConfigEntry
+{
+  std::uint32_t key;
+  std::uint32_t value;
+};
+
+// The first block of an MSF 7 file, which is what current PDBs are
+struct MsfSuperBlock
+{
+  char magic[32];
+  std::uint32_t blockSize;
+  std::uint32_t freeBlockMap;
+  std::uint32_t blockCount;
+  std::uint32_t directoryBytes;
+  std::uint32_t reserved;
+  std::uint32_t blockMap;
+};
+
+const char MsfMagic[] = "Microsoft C/C++ MSF 7.00\r\n\x1a" "DS\0\0";
+
+// The start of stream 1, the same signature and age the image refers to
+struct PdbInfoHeader
+{
+  std::uint32_t version;
+  std::uint32_t signature;
+  std::uint32_t age;
+  GUID guid;
+};
+
+bool ReadAt(HANDLE file, std::uint64_t offset, void *data, size_t size)
+{
+  OVERLAPPED ov = {};
+  ov.Offset = static_cast<DWORD>(offset);
+  ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD read = 0;
+  return ReadFile(file, data, static_cast<DWORD>(size), &read, &ov) && read == size;
+}
+
+// Only the stream directory and the start of the info stream are read, which
+// is a few blocks even for large PDBs
+bool ReadPdbSignature(HANDLE file, GUID &signature, DWORD &age)
+{
+  MsfSuperBlock super;
+  if(!ReadAt(file, 0, &super, sizeof(super)) || memcmp(super.magic, MsfMagic, sizeof(super.magic)) != 0)
+  {
+    return false;
+  }
+  const std::uint64_t blockSize = super.blockSize;
+  if(blockSize < 512 || (blockSize & (blockSize - 1)) != 0 || super.directoryBytes < 3 * sizeof(std::uint32_t))
+  {
+    return false;
+  }
+  // the directory is spread over the blocks the block map lists
+  const auto directoryBlocks = static_cast<size_t>((super.directoryBytes + blockSize - 1) / blockSize);
+  if(directoryBlocks * sizeof(std::uint32_t) > blockSize)
+  {
+    return false;
+  }
+  std::vector<std::uint32_t> blocks(directoryBlocks);
+  if(!ReadAt(file, super.blockMap * blockSize, blocks.data(), blocks.size() * sizeof(std::uint32_t)))
+  {
+    return false;
+  }
+  std::vector<std::uint32_t> directory(directoryBlocks * blockSize / sizeof(std::uint32_t));
+  for(size_t i = 0; i < blocks.size(); ++i)
+  {
+    if(!ReadAt(file, blocks[i] * blockSize, &directory[i * blockSize / sizeof(std::uint32_t)], static_cast<size_t>(blockSize)))
+    {
+      return false;
+    }
+  }
+  // stream count, the stream sizes, then the blocks of each stream in order,
+  // so those of the info stream follow the ones of stream 0
+  const size_t words = super.directoryBytes / sizeof(std::uint32_t);
+  const size_t streams = directory[0];
+  if(streams < 2 || streams >= words)
+  {
+    return false;
+  }
+  const auto stream0Bytes = directory[1];
+  const auto stream0Blocks = stream0Bytes == 0xFFFFFFFF ? 0 : (stream0Bytes + blockSize - 1) / blockSize;
+  const auto infoBlock = 1 + streams + stream0Blocks;
+  if(directory[2] == 0xFFFFFFFF || directory[2] < sizeof(PdbInfoHeader) || infoBlock >= words)
+  {
+    return false;
+  }
+  PdbInfoHeader info;
+  if(!ReadAt(file, directory[static_cast<size_t>(infoBlock)] * blockSize, &info, sizeof(info)))
+  {
+    return false;
+  }
+  signature = info.guid;
+  age = info.age;
+  return true;
+}
+
+} // private namespace
+
+PdbStamp::PdbStamp()
+  : size(0)
+  , writeTime(0)
+  , signature()
+  , age(0)
+{
+}
+
+bool PdbStamp::operator==(const PdbStamp &other) const
+{
+  return size == other.size && writeTime == other.writeTime && age == other.age &&
+         memcmp(&signature, &other.signature, sizeof(GUID)) == 0;
+}
+
+bool ReadPdbStamp(const fs::path &pdbPath, PdbStamp &stamp)
+{
+  auto file = CreateFileW(pdbPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+  if(file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  stamp = PdbStamp();
+  BY_HANDLE_FILE_INFORMATION info;
+  const bool rv = GetFileInformationByHandle(file, &info) != FALSE;
+  if(rv)
+  {
+    stamp.size = (static_cast<std::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    stamp.writeTime = (static_cast<std::uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+    ReadPdbSignature(file, stamp.signature, stamp.age);
+  }
+  CloseHandle(file);
+  return rv;
+}
+
+//////////////////////////////
+
+FormatRecord::FormatRecord(const std::shared_ptr<const std::uint8_t> &data, size_t size)
+  : data_(data)
+  , size_(size)
+{
+}
+
+template <class T>
+const T *FormatRecord::At(std::uint32_t offset, std::uint32_t count) const
+{
+  if(offset % sizeof(std::uint32_t) != 0 || offset > size_ || count > (size_ - offset) / sizeof(T))
+  {
+    return nullptr;
+  }
+  return reinterpret_cast<const T *>(data_.get() + offset);
+}
+
+bool FormatRecord::String(std::uint32_t offset, std::wstring &str) const
+{
+  auto length = At<std::uint32_t>(offset);
+  if(!length || *length == 0xFFFFFFFF)
+  {
+    return false;
+  }
+  auto chars = At<wchar_t>(offset + sizeof(std::uint32_t), *length + 1);
+  if(!chars)
+  {
+    return false;
+  }
+  str.assign(chars, *length);
+  return true;
+}
+
+bool FormatRecord::IsValid() const
+{
+  auto header = At<RecordHeader>(0);
+  std::wstring path;
+  return header && header->size == size_ && size_ % 8 == 0 &&
+         String(header->pdbPath, path) &&
+         At<GUID>(header->traceGuids, header->traceGuidCount) &&
+         At<SourceFileEntry>(header->sourceFiles, header->sourceFileCount);
+}
+
+size_t FormatRecord::Size() const
+{
+  return size_;
+}
+
+const std::uint8_t *FormatRecord::Data() const
+{
+  return data_.get();
+}
+
+std::wstring FormatRecord::PdbPath() const
+{
+  std::wstring path;
+  String(At<RecordHeader>(0)->pdbPath, path);
+  return path;
+}
+
+PdbStamp FormatRecord::Stamp() const
+{
+  auto header = At<RecordHeader>(0);
+  PdbStamp stamp;
+  stamp.size = header->fileSize;
+  stamp.writeTime = header->writeTime;
+  stamp.signature = header->signature;
+  stamp.age = header->age;
+  return stamp;
+}
+
+std::vector<GUID> FormatRecord::TraceGuids() const
+{
+  auto header = At<RecordHeader>(0);
+  auto guids = At<GUID>(header->traceGuids, header->traceGuidCount);
+  return std::vector<GUID>(guids, guids + header->traceGuidCount);
+}
+
+std::vector<GUID> FormatRecord::SourceFileGuids() const
+{
+  auto header = At<RecordHeader>(0);
+  auto files = At<SourceFileEntry>(header->sourceFiles, header->sourceFileCount);
+  std::vector<GUID> guids;
+  guids.reserve(header->sourceFileCount);
+  for(std::uint32_t i = 0; i < header->sourceFileCount; ++i)
+  {
+    guids.push_back(files[i].fileGuid);
+  }
+  return guids;
+}
+
+// Formats that do not fit the record are skipped, a damaged cache costs the
+// events of a file their message rather than the process
+void FormatRecord::AddFormats(const GUID &fileGuid, const TraceFormatAddCallback &adder) const
+{
+  auto header = At<RecordHeader>(0);
+  auto files = At<SourceFileEntry>(header->sourceFiles, header->sourceFileCount);
+  auto end = files + header->sourceFileCount;
+  auto file = std::lower_bound(files, end, fileGuid, [](const SourceFileEntry &entry, const GUID &guid)
+  {
+    return GuidLess()(entry.fileGuid, guid);
+  });
+  if(file == end || memcmp(&file->fileGuid, &fileGuid, sizeof(GUID)) != 0)
+  {
+    return;
+  }
+  auto formats = At<FormatEntry>(file->formats, file->formatCount);
+  if(!formats)
+  {
+    return;
+  }
+  std::wstring sourcePath;
+  for(std::uint32_t i = 0; i < file->formatCount; ++i)
+  {
+    auto &entry = formats[i];
+    auto types = At<TypeEntry>(entry.types, entry.typeCount);
+    auto configs = At<ConfigEntry>(entry.configs, entry.configCount);
+    TraceFormat fmt;
+    if(!types || !configs ||
+       !String(entry.sourcePath, sourcePath) ||
+       !String(entry.moduleName, fmt.moduleName) ||
+       !String(entry.function, fmt.function) ||
+       !String(entry.formatString, fmt.formatString))
+    {
+      continue;
+    }
+    fmt.traceIndex = entry.traceIndex;
+    fmt.lineNumber = entry.lineNumber;
+    fmt.traceLevel = entry.traceLevel;
+    fmt.flags = entry.flags;
+    fmt.fileInfoFlags = entry.fileInfoFlags;
+    for(std::uint32_t t = 0; t < entry.typeCount; ++t)
+    {
+      TypeValue tv;
+      String(types[t].type, tv.type);
+      String(types[t].argName, tv.argName);
+      fmt.typeMap.emplace(types[t].key, std::move(tv));
+    }
+    for(std::uint32_t c = 0; c < entry.configCount; ++c)
+    {
+      std::wstring key;
+      std::wstring value;
+      String(configs[c].key, key);
+      String(configs[c].value, value);
+      fmt.traceCfg.emplace(std::move(key), std::move(value));
+    }
+    adder(fileGuid, sourcePath.c_str(), std::move(fmt));
+  }
+}
+
+//////////////////////////////
+
+void FormatRecordBuilder::AddTraceGuid(const GUID &traceGuid)
+{
+  traceGuids_.push_back(traceGuid);
+}
+
+void FormatRecordBuilder::AddFormat(const GUID &fileGuid, const wchar_t *sourcePath, TraceFormat &&fmt)
+{
+  files_[fileGuid].push_back(Entry {sourcePath ? sourcePath : L"", std::move(fmt)});
+}
+
+std::uint32_t FormatRecordBuilder::Add(const void *data, size_t size)
+{
+  bytes_.resize((bytes_.size() + 3) & ~static_cast<size_t>(3));
+  const auto offset = static_cast<std::uint32_t>(bytes_.size());
+  auto first = static_cast<const std::uint8_t *>(data);
+  bytes_.insert(bytes_.end(), first, first + size);
+  return offset;
+}
+
+std::uint32_t FormatRecordBuilder::AddString(const std::wstring &str)
+{
+  auto it = strings_.find(str);
+  if(it != strings_.end())
+  {
+    return it->second;
+  }
+  const auto length = static_cast<std::uint32_t>(str.size());
+  const auto offset = Add(&length, sizeof(length));
+  Add(str.c_str(), (str.size() + 1) * sizeof(wchar_t));
+  strings_.emplace(str, offset);
+  return offset;
+}
+
+std::shared_ptr<const FormatRecord> FormatRecordBuilder::Build(const std::wstring &pdbPath, const PdbStamp &stamp)
+{
+  RecordHeader header = {};
+  bytes_.assign(sizeof(header), 0);
+  header.pdbPath = AddString(pdbPath);
+  header.fileSize = stamp.size;
+  header.writeTime = stamp.writeTime;
+  header.signature = stamp.signature;
+  header.age = stamp.age;
+  header.traceGuidCount = static_cast<std::uint32_t>(traceGuids_.size());
+  header.traceGuids = Add(traceGuids_.data(), traceGuids_.size() * sizeof(GUID));
+  std::vector<SourceFileEntry> sourceFiles;
+  for(auto &&file : files_)
+  {
+    std::vector<FormatEntry> formats;
+    for(auto &&entry : file.second)
+    {
+      const auto &fmt = entry.format;
+      FormatEntry f = {};
+      f.sourcePath = AddString(entry.sourcePath);
+      f.moduleName = AddString(fmt.moduleName);
+      f.function = AddString(fmt.function);
+      f.formatString = AddString(fmt.formatString);
+      f.traceIndex = fmt.traceIndex;
+      f.lineNumber = fmt.lineNumber;
+      f.traceLevel = fmt.traceLevel;
+      f.flags = fmt.flags;
+      f.fileInfoFlags = fmt.fileInfoFlags;
+      std::vector<TypeEntry> types;
+      for(auto &&kv : fmt.typeMap)
+      {
+        types.push_back(TypeEntry {kv.first, AddString(kv.second.type), AddString(kv.second.argName)});
+      }
+      std::vector<ConfigEntry> configs;
+      for(auto &&kv : fmt.traceCfg)
+      {
+        configs.push_back(ConfigEntry {AddString(kv.first), AddString(kv.second)});
+      }
+      f.typeCount = static_cast<std::uint32_t>(types.size());
+      f.types = Add(types.data(), types.size() * sizeof(TypeEntry));
+      f.configCount = static_cast<std::uint32_t>(configs.size());
+      f.configs = Add(configs.data(), configs.size() * sizeof(ConfigEntry));
+      formats.push_back(f);
+    }
+    SourceFileEntry s = {};
+    s.fileGuid = file.first;
+    s.formatCount = static_cast<std::uint32_t>(formats.size());
+    s.formats = Add(formats.data(), formats.size() * sizeof(FormatEntry));
+    sourceFiles.push_back(s);
+  }
+  header.sourceFileCount = static_cast<std::uint32_t>(sourceFiles.size());
+  header.sourceFiles = Add(sourceFiles.data(), sourceFiles.size() * sizeof(SourceFileEntry));
+  bytes_.resize((bytes_.size() + 7) & ~static_cast<size_t>(7));
+  header.size = static_cast<std::uint32_t>(bytes_.size());
+  memcpy(bytes_.data(), &header, sizeof(header));
+  auto bytes = std::make_shared<std::vector<std::uint8_t>>(std::move(bytes_));
+  traceGuids_.clear();
+  files_.clear();
+  bytes_.clear();
+  strings_.clear();
+  return std::make_shared<FormatRecord>(std::shared_ptr<const std::uint8_t>(bytes, bytes->data()), bytes->size());
+}
+
+//////////////////////////////
+
+FormatCache::Impl::Impl(const fs::path &cacheFile)
+  : cacheFile_(cacheFile)
+  , changed_(false)
+{
+  Load();
+}
+
+// Records found damaged end the load, the PDBs they and the ones after them
+// cover are simply read again
+void FormatCache::Impl::Load()
+{
+  // a file moved aside by Save() can go once no one maps it any more
+  DeleteFileW((cacheFile_.wstring() + L".old").c_str());
+  size_t size;
+  auto data = MapWholeFile(cacheFile_, size);
+  if(!data || size < sizeof(CacheHeader))
+  {
+    return;
+  }
+  auto header = reinterpret_cast<const CacheHeader *>(data.get());
+  if(memcmp(header->magic, CacheMagic, sizeof(CacheMagic)) != 0 || header->version != CacheVersion)
+  {
+    return;
+  }
+  size_t offset = sizeof(CacheHeader);
+  for(std::uint32_t i = 0; i < header->recordCount && size - offset >= sizeof(RecordHeader); ++i)
+  {
+    const size_t recordSize = reinterpret_cast<const RecordHeader *>(data.get() + offset)->size;
+    if(recordSize > size - offset)
+    {
+      break;
+    }
+    auto record = std::make_shared<FormatRecord>(std::shared_ptr<const std::uint8_t>(data, data.get() + offset), recordSize);
+    if(!record->IsValid())
+    {
+      break;
+    }
+    // stored as the key, a relative path would resolve against today's directory
+    records_[record->PdbPath()] = record;
+    offset += recordSize;
+  }
+}
+
+// The full path, without . and .. parts, in lower case. Records carry the
+// key of their PDB, not the path it was loaded by.
+std::wstring FormatCache::Impl::Key(const fs::path &pdbPath)
+{
+  std::wstring key(MAX_PATH, L'\0');
+  auto length = GetFullPathNameW(pdbPath.c_str(), static_cast<DWORD>(key.size()), &key[0], nullptr);
+  if(length > key.size())
+  {
+    key.resize(length);
+    length = GetFullPathNameW(pdbPath.c_str(), static_cast<DWORD>(key.size()), &key[0], nullptr);
+  }
+  if(length == 0 || length > key.size())
+  {
+    key = pdbPath.wstring();
+  }
+  else
+  {
+    key.resize(length);
+  }
+  std::transform(key.begin(), key.end(), key.begin(), towlower);
+  return key;
+}
+
+std::shared_ptr<const FormatRecord> FormatCache::Impl::Find(const fs::path &pdbPath, const PdbStamp &stamp) const
+{
+  std::lock_guard<std::mutex> l(lock_);
+  auto it = records_.find(Key(pdbPath));
+  if(it == records_.end() || !(it->second->Stamp() == stamp))
+  {
+    return nullptr;
+  }
+  return it->second;
+}
+
+void FormatCache::Impl::Store(const fs::path &pdbPath, const std::shared_ptr<const FormatRecord> &record)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  records_[Key(pdbPath)] = record;
+  changed_ = true;
+}
+
+// Records for PDBs not seen this run are kept, a cache may cover several
+// symbol directories
+bool FormatCache::Impl::Save() const
+{
+  std::lock_guard<std::mutex> l(lock_);
+  if(!changed_)
+  {
+    return true;
+  }
+  CacheHeader header = {};
+  memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+  header.version = CacheVersion;
+  header.recordCount = static_cast<std::uint32_t>(records_.size());
+  auto first = reinterpret_cast<const std::uint8_t *>(&header);
+  std::vector<std::uint8_t> image(first, first + sizeof(header));
+  for(auto &&kv : records_)
+  {
+    image.insert(image.end(), kv.second->Data(), kv.second->Data() + kv.second->Size());
+  }
+  const auto cacheFile = cacheFile_.wstring();
+  const auto newFile = cacheFile + L".new";
+  if(!WriteWholeFile(newFile, image.data(), image.size()))
+  {
+    return false;
+  }
+  if(!MoveFileExW(newFile.c_str(), cacheFile.c_str(), MOVEFILE_REPLACE_EXISTING))
+  {
+    // a mapped file cannot be replaced but it can be renamed
+    const auto oldFile = cacheFile + L".old";
+    DeleteFileW(oldFile.c_str());
+    if(!MoveFileExW(cacheFile.c_str(), oldFile.c_str(), MOVEFILE_REPLACE_EXISTING) ||
+       !MoveFileExW(newFile.c_str(), cacheFile.c_str(), 0))
+    {
+      DeleteFileW(newFile.c_str());
+      return false;
+    }
+  }
+  changed_ = false;
+  return true;
+}
+
+//////////////////////////////
+
+FormatCache::FormatCache(const fs::path &cacheFile)
+  : impl_(std::make_shared<FormatCache::Impl>(cacheFile))
+{
+}
+
+FormatCache::~FormatCache()
+{
+}
+
+bool FormatCache::Save() const
+{
+  return impl_->Save();
+}
+
+} // namespace etl
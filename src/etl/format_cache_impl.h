@@ -0,0 +1,88 @@
+#pragma once
+#include <ampp/etl/format_cache.h>
+#include <ampp/etl/guid_util.h>
+#include <ampp/etl/trace_base.h>
+#include "trace_format_impl.h"
+
+namespace etl
+{
+
+// Identifies one build of a PDB. Signature and age are read from the PDB
+// info stream, they are left zero for files that are not MSF 7.
+struct PdbStamp
+{
+  std::uint64_t size;
+  std::uint64_t writeTime;
+  GUID signature;
+  DWORD age;
+  //
+  PdbStamp();
+  bool operator==(const PdbStamp &other) const;
+};
+
+bool ReadPdbStamp(const fs::path &pdbPath, PdbStamp &stamp);
+
+// The formats one PDB provides, in the layout of the cache file. The bytes
+// are either part of the mapped cache file or were harvested this run, every
+// offset is checked before it is used.
+class FormatRecord
+{
+public:
+  FormatRecord(const std::shared_ptr<const std::uint8_t> &data, size_t size);
+  bool IsValid() const;
+  size_t Size() const;
+  const std::uint8_t *Data() const;
+  std::wstring PdbPath() const;
+  PdbStamp Stamp() const;
+  std::vector<GUID> TraceGuids() const;
+  std::vector<GUID> SourceFileGuids() const;
+  void AddFormats(const GUID &fileGuid, const TraceFormatAddCallback &adder) const;
+private:
+  template <class T>
+  const T *At(std::uint32_t offset, std::uint32_t count = 1) const;
+  bool String(std::uint32_t offset, std::wstring &str) const;
+private:
+  std::shared_ptr<const std::uint8_t> data_;
+  size_t size_;
+};
+
+// Collects the formats of one PDB while it is loaded and lays them out as a
+// record. Strings repeated across formats, like paths, are stored once.
+class FormatRecordBuilder
+{
+public:
+  void AddTraceGuid(const GUID &traceGuid);
+  void AddFormat(const GUID &fileGuid, const wchar_t *sourcePath, TraceFormat &&fmt);
+  std::shared_ptr<const FormatRecord> Build(const std::wstring &pdbPath, const PdbStamp &stamp);
+private:
+  struct Entry
+  {
+    std::wstring sourcePath;
+    TraceFormat format;
+  };
+  std::uint32_t Add(const void *data, size_t size);
+  std::uint32_t AddString(const std::wstring &str);
+  std::vector<GUID> traceGuids_;
+  GuidKeyedMap<std::vector<Entry>> files_;
+  std::vector<std::uint8_t> bytes_;
+  std::map<std::wstring, std::uint32_t> strings_;
+};
+
+class FormatCache::Impl
+{
+public:
+  explicit Impl(const fs::path &cacheFile);
+  std::shared_ptr<const FormatRecord> Find(const fs::path &pdbPath, const PdbStamp &stamp) const;
+  void Store(const fs::path &pdbPath, const std::shared_ptr<const FormatRecord> &record);
+  bool Save() const;
+  static std::wstring Key(const fs::path &pdbPath);
+private:
+  void Load();
+private:
+  fs::path cacheFile_;
+  std::map<std::wstring, std::shared_ptr<const FormatRecord>> records_;
+  mutable bool changed_;
+  mutable std::mutex lock_;
+};
+
+} // namespace etl
@@ -0,0 +1,151 @@
+#pragma once
+
+namespace etl
+{
+
+// Open addressing table keyed by GUID for small values like pointers. It is
+// kept at most half full, so a lookup usually reads a single slot. Entries
+// are never changed or removed, which lets Find() run without a lock while
+// one thread at a time inserts. Slot arrays it has outgrown are kept until
+// the table goes, a lookup may still be reading one.
+template <class V>
+class GuidTable
+{
+public:
+  GuidTable();
+  GuidTable(const GuidTable &) = delete;
+  GuidTable &operator=(const GuidTable &) = delete;
+  size_t Size() const;
+  const V *Find(const GUID &key) const;
+  bool Insert(const GUID &key, const V &value);
+private:
+  struct Slot
+  {
+    GUID key;
+    V value;
+    std::atomic<bool> used;
+  };
+  struct Slots
+  {
+    size_t mask;
+    std::unique_ptr<Slot[]> slot;
+  };
+  static size_t Hash(const GUID &key);
+  static Slot &Probe(const Slots &slots, const GUID &key);
+  static std::unique_ptr<Slots> MakeSlots(size_t count);
+  void Grow();
+private:
+  std::atomic<const Slots *> slots_;
+  std::vector<std::unique_ptr<Slots>> arrays_;
+  size_t size_;
+};
+
+template <class V>
+GuidTable<V>::GuidTable()
+  : size_(0)
+{
+  arrays_.push_back(MakeSlots(16));
+  slots_.store(arrays_.back().get());
+}
+
+template <class V>
+size_t GuidTable<V>::Size() const
+{
+  return size_;
+}
+
+template <class V>
+const V *GuidTable<V>::Find(const GUID &key) const
+{
+  // used is read once per slot, a slot filled after that read is seen on the
+  // next lookup
+  auto &slots = *slots_.load(std::memory_order_acquire);
+  for(auto index = Hash(key) & slots.mask;; index = (index + 1) & slots.mask)
+  {
+    auto &slot = slots.slot[index];
+    if(!slot.used.load(std::memory_order_acquire))
+    {
+      return nullptr;
+    }
+    if(memcmp(&slot.key, &key, sizeof(GUID)) == 0)
+    {
+      return &slot.value;
+    }
+  }
+}
+
+// Adds key unless it is there already. Callers serialize inserts.
+template <class V>
+bool GuidTable<V>::Insert(const GUID &key, const V &value)
+{
+  auto slot = &Probe(*slots_.load(std::memory_order_relaxed), key);
+  if(slot->used.load(std::memory_order_relaxed))
+  {
+    return false;
+  }
+  if(2 * (size_ + 1) > arrays_.back()->mask + 1)
+  {
+    Grow();
+    slot = &Probe(*slots_.load(std::memory_order_relaxed), key);
+  }
+  slot->key = key;
+  slot->value = value;
+  slot->used.store(true, std::memory_order_release);
+  ++size_;
+  return true;
+}
+
+// GUIDs are random enough that folding both halves together spreads them well
+template <class V>
+size_t GuidTable<V>::Hash(const GUID &key)
+{
+  std::uint64_t half[2];
+  memcpy(half, &key, sizeof(half));
+  auto h = (half[0] ^ half[1]) * 0x9E3779B97F4A7C15ULL;
+  return static_cast<size_t>(h ^ (h >> 32));
+}
+
+// The slot holding key, or the free slot it would go to
+template <class V>
+typename GuidTable<V>::Slot &GuidTable<V>::Probe(const Slots &slots, const GUID &key)
+{
+  for(auto index = Hash(key) & slots.mask;; index = (index + 1) & slots.mask)
+  {
+    auto &slot = slots.slot[index];
+    if(!slot.used.load(std::memory_order_acquire) || memcmp(&slot.key, &key, sizeof(GUID)) == 0)
+    {
+      return slot;
+    }
+  }
+}
+
+template <class V>
+std::unique_ptr<typename GuidTable<V>::Slots> GuidTable<V>::MakeSlots(size_t count)
+{
+  auto slots = std::make_unique<Slots>();
+  slots->mask = count - 1;
+  slots->slot.reset(new Slot[count]());
+  return slots;
+}
+
+template <class V>
+void GuidTable<V>::Grow()
+{
+  auto &current = *arrays_.back();
+  auto slots = MakeSlots(2 * (current.mask + 1));
+  for(size_t i = 0; i <= current.mask; ++i)
+  {
+    auto &slot = current.slot[i];
+    if(slot.used.load(std::memory_order_relaxed))
+    {
+      auto &target = Probe(*slots, slot.key);
+      target.key = slot.key;
+      target.value = slot.value;
+      target.used.store(true, std::memory_order_relaxed);
+    }
+  }
+  arrays_.push_back(std::move(slots));
+  slots_.store(arrays_.back().get(), std::memory_order_release);
+}
+
+} // namespace etl
@@ -0,0 +1,272 @@
+#include "stdafx.h"
+#include "number_util.h"
+
+namespace etl
+{
+
+namespace
+{
+
+const char DigitPairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+const wchar_t UpperHexDigits[] = L"0123456789ABCDEF";
+const wchar_t LowerHexDigits[] = L"0123456789abcdef";
+
+// Large enough for 64 bits in octal plus prefix and sign
+const size_t MaxDigits = 32;
+
+// Writes the digits of v backwards so that they end at 'end', returns the first digit.
+wchar_t *WriteDecimal(wchar_t *end, std::uint64_t v)
+{
+  while(v >= 100)
+  {
+    auto pair = static_cast<size_t>(v % 100) * 2;
+    v /= 100;
+    *--end = static_cast<wchar_t>(DigitPairs[pair + 1]);
+    *--end = static_cast<wchar_t>(DigitPairs[pair]);
+  }
+  if(v >= 10)
+  {
+    auto pair = static_cast<size_t>(v) * 2;
+    *--end = static_cast<wchar_t>(DigitPairs[pair + 1]);
+    *--end = static_cast<wchar_t>(DigitPairs[pair]);
+  }
+  else
+  {
+    *--end = static_cast<wchar_t>(L'0' + v);
+  }
+  return end;
+}
+
+wchar_t *WriteHex(wchar_t *end, std::uint64_t v, const wchar_t *digits)
+{
+  do
+  {
+    *--end = digits[v & 0xF];
+    v >>= 4;
+  } while(v != 0);
+  return end;
+}
+
+wchar_t *WriteOctal(wchar_t *end, std::uint64_t v)
+{
+  do
+  {
+    *--end = static_cast<wchar_t>(L'0' + (v & 0x7));
+    v >>= 3;
+  } while(v != 0);
+  return end;
+}
+
+void AppendPadded(std::wstring &out, const wchar_t *prefix, size_t prefixLen, const wchar_t *digits, size_t digitLen, const NumberFormat &nf)
+{
+  size_t precisionZeros = 0;
+  if(nf.precision >= 0 && static_cast<size_t>(nf.precision) > digitLen)
+  {
+    precisionZeros = nf.precision - digitLen;
+  }
+  const size_t len = prefixLen + precisionZeros + digitLen;
+  const size_t pad = nf.width > 0 && static_cast<size_t>(nf.width) > len ? nf.width - len : 0;
+  if(pad > 0 && !nf.leftAlign && !(nf.zeroPad && nf.precision < 0))
+  {
+    out.append(pad, L' ');
+  }
+  out.append(prefix, prefixLen);
+  if(pad > 0 && !nf.leftAlign && nf.zeroPad && nf.precision < 0)
+  {
+    out.append(pad, L'0');
+  }
+  out.append(precisionZeros, L'0');
+  out.append(digits, digitLen);
+  if(pad > 0 && nf.leftAlign)
+  {
+    out.append(pad, L' ');
+  }
+}
+
+} // private namespace
+
+NumberFormat::NumberFormat()
+  : conversion(L'd')
+  , width(0)
+  , precision(-1)
+  , zeroPad(false)
+  , leftAlign(false)
+  , alternate(false)
+  , plusSign(false)
+  , spaceSign(false)
+{
+}
+
+bool ParseNumberFormat(const std::wstring &spec, NumberFormat &nf)
+{
+  nf = NumberFormat();
+  auto cur = spec.cbegin();
+  auto end = spec.cend();
+  for(; cur != end; ++cur)
+  {
+    if(*cur == L'0')
+    {
+      nf.zeroPad = true;
+    }
+    else if(*cur == L'-')
+    {
+      nf.leftAlign = true;
+    }
+    else if(*cur == L'#')
+    {
+      nf.alternate = true;
+    }
+    else if(*cur == L'+')
+    {
+      nf.plusSign = true;
+    }
+    else if(*cur == L' ')
+    {
+      nf.spaceSign = true;
+    }
+    else
+    {
+      break;
+    }
+  }
+  while(cur != end && *cur >= L'0' && *cur <= L'9')
+  {
+    nf.width = nf.width * 10 + (*cur++ - L'0');
+  }
+  if(cur != end && *cur == L'.')
+  {
+    ++cur;
+    nf.precision = 0;
+    while(cur != end && *cur >= L'0' && *cur <= L'9')
+    {
+      nf.precision = nf.precision * 10 + (*cur++ - L'0');
+    }
+  }
+  // length modifiers carry no information, the argument type decides the width
+  static const wchar_t *lengthModifiers[] = { L"I64", L"I32", L"ll", L"hh", L"l", L"h", L"I", L"z", L"j", L"t" };
+  for(auto lm : lengthModifiers)
+  {
+    auto lmLen = wcslen(lm);
+    if(static_cast<size_t>(end - cur) > lmLen && std::equal(lm, lm + lmLen, cur))
+    {
+      cur += lmLen;
+      break;
+    }
+  }
+  if(cur == end)
+  {
+    // bare "%N!!" or an empty spec means plain decimal
+    return spec.empty();
+  }
+  switch(*cur)
+  {
+  case L'd':
+  case L'i':
+  case L'u':
+  case L'x':
+  case L'X':
+  case L'o':
+  case L'p':
+    nf.conversion = *cur;
+    break;
+  default:
+    return false;
+  }
+  return cur + 1 == end;
+}
+
+void AppendSigned(std::wstring &out, std::int64_t value, int valueBytes, const NumberFormat &nf)
+{
+  if(nf.conversion != L'd' && nf.conversion != L'i')
+  {
+    AppendUnsigned(out, static_cast<std::uint64_t>(value), valueBytes, nf);
+    return;
+  }
+  wchar_t buf[MaxDigits];
+  auto end = buf + MaxDigits;
+  auto magnitude = value < 0 ? 0 - static_cast<std::uint64_t>(value) : static_cast<std::uint64_t>(value);
+  auto first = nf.precision == 0 && value == 0 ? end : WriteDecimal(end, magnitude);
+  wchar_t sign = value < 0 ? L'-' : nf.plusSign ? L'+' : nf.spaceSign ? L' ' : 0;
+  AppendPadded(out, &sign, sign ? 1 : 0, first, end - first, nf);
+}
+
+void AppendUnsigned(std::wstring &out, std::uint64_t value, int valueBytes, const NumberFormat &nf)
+{
+  if(valueBytes < static_cast<int>(sizeof(value)))
+  {
+    value &= (std::uint64_t(1) << (valueBytes * 8)) - 1;
+  }
+  wchar_t buf[MaxDigits];
+  auto end = buf + MaxDigits;
+  const wchar_t *first = end;
+  const wchar_t *prefix = L"";
+  size_t prefixLen = 0;
+  NumberFormat pnf = nf;
+  switch(nf.conversion)
+  {
+  case L'x':
+    first = WriteHex(end, value, LowerHexDigits);
+    prefix = L"0x";
+    prefixLen = nf.alternate && value != 0 ? 2 : 0;
+    break;
+  case L'X':
+    first = WriteHex(end, value, UpperHexDigits);
+    prefix = L"0X";
+    prefixLen = nf.alternate && value != 0 ? 2 : 0;
+    break;
+  case L'p':
+    first = WriteHex(end, value, UpperHexDigits);
+    pnf.precision = valueBytes * 2;
+    break;
+  case L'o':
+    first = WriteOctal(end, value);
+    if(nf.alternate && value != 0)
+    {
+      prefix = L"0";
+      prefixLen = 1;
+    }
+    break;
+  default:
+    first = WriteDecimal(end, value);
+    break;
+  }
+  if(nf.precision == 0 && value == 0)
+  {
+    first = end;
+  }
+  AppendPadded(out, prefix, prefixLen, first, end - first, pnf);
+}
+
+void AppendDecimal(std::wstring &out, std::uint64_t value)
+{
+  wchar_t buf[MaxDigits];
+  auto end = buf + MaxDigits;
+  auto first = WriteDecimal(end, value);
+  out.append(first, end);
+}
+
+void AppendHex(std::wstring &out, std::uint64_t value, int minDigits, bool upperCase)
+{
+  wchar_t buf[MaxDigits];
+  auto end = buf + MaxDigits;
+  auto first = WriteHex(end, value, upperCase ? UpperHexDigits : LowerHexDigits);
+  auto digits = static_cast<int>(end - first);
+  if(minDigits > digits)
+  {
+    out.append(minDigits - digits, L'0');
+  }
+  out.append(first, end);
+}
+
+} // namespace etl
@@ -0,0 +1,29 @@
+#pragma once
+
+namespace etl
+{
+
+// Pre-parsed printf integer conversion, e.g. "08X", "I64x" or "-5d".
+struct NumberFormat
+{
+  wchar_t conversion;
+  int width;
+  int precision;
+  bool zeroPad;
+  bool leftAlign;
+  bool alternate;
+  bool plusSign;
+  bool spaceSign;
+  //
+  NumberFormat();
+};
+
+// Returns false if the spec is not an integer conversion the kernels handle.
+bool ParseNumberFormat(const std::wstring &spec, NumberFormat &nf);
+
+void AppendSigned(std::wstring &out, std::int64_t value, int valueBytes, const NumberFormat &nf);
+void AppendUnsigned(std::wstring &out, std::uint64_t value, int valueBytes, const NumberFormat &nf);
+void AppendDecimal(std::wstring &out, std::uint64_t value);
+void AppendHex(std::wstring &out, std::uint64_t value, int minDigits, bool upperCase);
+
+} // namespace etl
@@ -0,0 +1,146 @@
+#include "stdafx.h"
+#include "parallel_util.h"
+
+namespace etl
+{
+
+namespace
+{
+
+struct ParallelJob
+{
+  const std::function<void (size_t index)> *body;
+  size_t count;
+  std::atomic<size_t> next;
+  std::atomic<size_t> finished;
+  std::atomic<size_t> helpers;
+  std::mutex lock;
+  std::condition_variable done;
+};
+
+class WorkerPool
+{
+public:
+  WorkerPool();
+  ~WorkerPool();
+  void Run(ParallelJob &job);
+  static WorkerPool &Instance();
+private:
+  void Worker();
+  static void Work(ParallelJob &job);
+private:
+  std::vector<std::thread> workers_;
+  std::list<ParallelJob *> jobs_;
+  std::mutex lock_;
+  std::condition_variable wake_;
+  bool stop_;
+};
+
+WorkerPool::WorkerPool()
+  : stop_(false)
+{
+  auto threads = std::thread::hardware_concurrency();
+  for(unsigned i = 1; i < threads; ++i)
+  {
+    workers_.emplace_back([this]() { Worker(); });
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for(auto &&worker : workers_)
+  {
+    worker.join();
+  }
+}
+
+WorkerPool &WorkerPool::Instance()
+{
+  static WorkerPool pool;
+  return pool;
+}
+
+void WorkerPool::Work(ParallelJob &job)
+{
+  for(auto i = job.next++; i < job.count; i = job.next++)
+  {
+    (*job.body)(i);
+    if(++job.finished == job.count)
+    {
+      std::lock_guard<std::mutex> l(job.lock);
+      job.done.notify_all();
+    }
+  }
+}
+
+void WorkerPool::Worker()
+{
+  for(;;)
+  {
+    ParallelJob *job;
+    {
+      std::unique_lock<std::mutex> l(lock_);
+      wake_.wait(l, [this]() { return stop_ || !jobs_.empty(); });
+      if(stop_)
+      {
+        return;
+      }
+      job = jobs_.front();
+      if(job->next >= job->count)
+      {
+        // every index is taken, the job only waits for its stragglers now
+        jobs_.pop_front();
+        continue;
+      }
+      ++job->helpers;
+    }
+    Work(*job);
+    std::lock_guard<std::mutex> l(job->lock);
+    --job->helpers;
+    job->done.notify_all();
+  }
+}
+
+void WorkerPool::Run(ParallelJob &job)
+{
+  if(!workers_.empty() && job.count > 1)
+  {
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      jobs_.push_back(&job);
+    }
+    wake_.notify_all();
+  }
+  Work(job);
+  {
+    std::unique_lock<std::mutex> l(job.lock);
+    // helpers may still be leaving Work after the last index finished
+    job.done.wait(l, [&job]() { return job.finished == job.count && job.helpers == 0; });
+  }
+  std::lock_guard<std::mutex> l(lock_);
+  jobs_.remove(&job);
+}
+
+} // private namespace
+
+void ParallelFor(size_t count, const std::function<void (size_t index)> &body)
+{
+  if(count == 0)
+  {
+    return;
+  }
+  ParallelJob job;
+  job.body = &body;
+  job.count = count;
+  job.next = 0;
+  job.finished = 0;
+  job.helpers = 0;
+  WorkerPool::Instance().Run(job);
+}
+
+} // namespace etl
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace etl
+{
+
+// Calls body(i) for every i in [0, count) on a shared pool of worker threads
+// and returns once all calls have finished. The calling thread takes part, so
+// nested calls cannot starve. Indices are handed out in order but may finish
+// in any order.
+void ParallelFor(size_t count, const std::function<void (size_t index)> &body);
+
+} // namespace etl
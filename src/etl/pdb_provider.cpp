@@ -4,6 +4,8 @@
 #include <ampp/etl/pdb_file.h>
 #include <ampp/etl/string_util.h>
 #include "trace_format_impl.h"
+#include "format_cache_impl.h"
+#include "tmf_parse.h"
 
 namespace etl
 {
@@ -27,63 +29,62 @@ const wchar_t *AdvanceStringUntilAfter(const wchar_t *s, const wchar_t *end, con
   return s < end ? AdvanceString(s) : s;
 }
 
-ConfigMap SplitConfig(const wchar_t *&cur, const wchar_t *end)
+bool EnumerateTrace(const PdbSymbol &sym, Architecture arch, const TraceFormatAddCallback &adder)
 {
-  ConfigMap rv;
-  auto vv = Split(cur, end, L' ');
-  for(auto &&cv : vv)
+  const wchar_t *name = sym.Descriptor();
+  const auto endName = name + sym.DescriptorLength();
+  if (wcscmp(name, L"TMF:") == 0)
   {
-    auto cfg = Split(cv, L'=');
-    rv.emplace(cfg[0], cfg[1]);
+    TraceFormat traceFormat;
+
+    traceFormat.function = sym.Name();
+    traceFormat.lineNumber = sym.LineNumber();
+    traceFormat.fileInfoFlags = arch ==  Architecture::X64 ? FIF_64BIT_TRACE : FIF_32BIT_TRACE;
+
+    auto modInfo = AdvanceString(name);
+    GUID fileGuid;
+    ConfigMap modCfg;
+    ParseModuleLine(modInfo, fileGuid, traceFormat.moduleName, modCfg);
+    auto fmtInfo = AdvanceString(modInfo);
+    ParseFormatLine(fmtInfo, traceFormat.formatString, traceFormat.traceCfg, traceFormat.traceIndex);
+    auto str = AdvanceStringUntilAfter(fmtInfo, endName, L"{");
+    while (str < endName && wcscmp(str, L"}") != 0)
+    {
+      DWORD index;
+      TypeValue tv;
+      if (ParseTypeLine(str, index, tv))
+      {
+        traceFormat.typeMap.emplace(index, std::move(tv));
+      }
+      str = AdvanceString(str);
+    }
+    adder(fileGuid, sym.SourceFile(), std::move(traceFormat));
   }
-  return rv;
+  return true;
 }
 
-bool ParseFormatStr(const wchar_t *&fmtLine, const wchar_t *endFmtLine, std::wstring &fmtString)
+// Reads every format of a PDB into a record, one pass over its annotations
+std::shared_ptr<const FormatRecord> HarvestPdb(const PdbFileManager &fm, const fs::path &pdbPath, const PdbStamp &stamp)
 {
-  auto cur = fmtLine;
-  //auto last = fmtLine + wcslen(fmtLine);
-  auto first = std::find(cur, endFmtLine, L'\"');
-  if(first == endFmtLine)
+  auto pdbFile = fm.LoadPdb(pdbPath);
+  if(!pdbFile)
   {
-    return false;
+    return nullptr;
   }
-  ++first;
-  std::reverse_iterator<const wchar_t *> begin(endFmtLine);
-  std::reverse_iterator<const wchar_t *> end(first);
-  auto final = std::find(begin, end, L'\"');
-  if(final == end)
+  FormatRecordBuilder builder;
+  for (auto &&tguid : pdbFile->GetTraceProviderGuids())
   {
-    return false;
+    builder.AddTraceGuid(tguid);
   }
-  ++final;
-  auto endOfString = final.base();
-  fmtString.assign(first, endOfString);
-  fmtLine = endOfString + 2;
-  return true;
-}
-
-bool ParseFormatLine(const wchar_t *fmtLine, std::wstring &fmtString, ConfigMap &cfgMap, DWORD &traceIndex)
-{
-  auto cur = fmtLine;
-  auto last = fmtLine + wcslen(fmtLine);
-  // skip #typev
-  SkipUntil(cur, last, L' ');
-  Skip(cur, last, L' ');
-  // skip <id>
-  SkipUntil(cur, last, L' ');
-  Skip(cur, last, L' ');
-  // get trace index
-  traceIndex = wcstoul(cur, nullptr, 10);
-  if(!ParseFormatStr(cur, last, fmtString))
+  const TraceFormatAddCallback adder = [&builder](const GUID &fileGuid, const wchar_t *sourcePath, TraceFormat &&traceFormat)
   {
-    return false;
-  }
-  Skip(cur, last, L' ');
-  Skip(cur, last, L'/');
-  Skip(cur, last, L' ');
-  cfgMap = SplitConfig(cur, last);
-  return true;
+    builder.AddFormat(fileGuid, sourcePath, std::move(traceFormat));
+  };
+  pdbFile->EnumerateAnnotations([&adder, arch = pdbFile->GetArchitecture()](const PdbSymbol &sym) -> bool
+  {
+    return EnumerateTrace(sym, arch, adder);
+  });
+  return builder.Build(FormatCache::Impl::Key(pdbPath), stamp);
 }
 
 } // private namespace
@@ -94,23 +95,24 @@ bool ParseFormatLine(const wchar_t *fmtLine, std::wstring &fmtString, ConfigMap
 class PdbProvider::Impl
 {
 public:
-  Impl(const PdbFileManager &fm, const fs::path &pdbPath);
+  Impl(const PdbFileManager &fm, const fs::path &pdbPath, const std::shared_ptr<FormatCache::Impl> &cache);
   ~Impl();
   bool EnumerateTraces(const SourceFileCallback &sourceFileCb, const TraceGuidCallback &traceGuidCb) const;
 private:
   bool ProvideForPdbFile(const SourceFileCallback &sourceFileCb, const TraceGuidCallback &traceGuidCb, const fs::path &pdbPath) const;
-private:
-  bool EnumerateTrace(const PdbSymbol &sym, Architecture arch, const TraceFormatAddCallback &adder) const;
+  std::shared_ptr<const FormatRecord> CachedRecord(const fs::path &pdbPath) const;
 private:
   const PdbFileManager &fm_;
   fs::path pdbPath_;
+  std::shared_ptr<FormatCache::Impl> cache_;
 };
 
 //////////////////
 
-PdbProvider::Impl::Impl(const PdbFileManager &fm, const fs::path &pdbPath)
+PdbProvider::Impl::Impl(const PdbFileManager &fm, const fs::path &pdbPath, const std::shared_ptr<FormatCache::Impl> &cache)
   : fm_(fm)
   , pdbPath_(pdbPath)
+  , cache_(cache)
 {
 }
 
@@ -118,72 +120,52 @@ PdbProvider::Impl::~Impl()
 {
 }
 
-bool PdbProvider::Impl::EnumerateTrace(const PdbSymbol &sym, Architecture arch, const TraceFormatAddCallback &adder) const
-{
-  const wchar_t *name = sym.Descriptor();
-  const auto endName = name + sym.DescriptorLength();
-  if (wcscmp(name, L"TMF:") == 0)
-  {
-    TraceFormat traceFormat;
-
-    traceFormat.function = sym.Name();
-    traceFormat.lineNumber = sym.LineNumber();
-    traceFormat.fileInfoFlags = arch ==  Architecture::X64 ? FIF_64BIT_TRACE : FIF_32BIT_TRACE;
-
-    auto modInfo = AdvanceString(name);
-    auto modData = Split<wchar_t>(modInfo, nullptr, L' ');
-    GUID fileGuid;
-    GuidFromString(modData[0], &fileGuid);
-    traceFormat.moduleName = modData[1];
-    auto fmtInfo = AdvanceString(modInfo);
-    ParseFormatLine(fmtInfo, traceFormat.formatString, traceFormat.traceCfg, traceFormat.traceIndex);
-    auto str = AdvanceStringUntilAfter(fmtInfo, endName, L"{");
-    while (str < endName && wcscmp(str, L"}") != 0)
-    {
-      auto typeInfo = Split(str, endName, L", ");
-      TypeValue tv;
-      tv.argName = typeInfo[0];
-      auto tid = Split(typeInfo[1], L" -- ");
-      tv.type = tid[0];
-      traceFormat.typeMap.emplace(std::wcstoul(tid[1].c_str(), nullptr, 10), std::move(tv));
-      str = AdvanceString(str);
-    }
-    adder(fileGuid, sym.SourceFile(), std::move(traceFormat));
-  }
-  return true;
-}
-
+// The PDB is loaded once, all of its formats are read into a record right
+// away and the callbacks share the record. They may run long after this
+// provider and the file manager are gone.
 bool PdbProvider::Impl::ProvideForPdbFile(const SourceFileCallback &sourceFileCb, const TraceGuidCallback &traceGuidCb, const fs::path &pdbPath) const
 {
-  auto pdbFile = fm_.LoadPdb(pdbPath);
-  if(!pdbFile)
+  auto record = cache_ ? CachedRecord(pdbPath) : HarvestPdb(fm_, pdbPath, PdbStamp());
+  if(!record)
   {
     return false;
   }
-  auto traceGuids = pdbFile->GetTraceProviderGuids();
-  for (auto &&tguid : traceGuids)
+  for (auto &&tguid : record->TraceGuids())
   {
     traceGuidCb(tguid, nullptr);
   }
-  auto guids = pdbFile->GetSourceFileGuids();
-  for (auto &&guid : guids)
+  for (auto &&guid : record->SourceFileGuids())
   {
-    sourceFileCb(guid, [this, pdbPath](const TraceFormatAddCallback &adder)
+    sourceFileCb(guid, [record, guid](const TraceFormatAddCallback &adder)
     {
-      auto pdbFile = fm_.LoadPdb(pdbPath);
-      if (pdbFile)
-      {
-        pdbFile->EnumerateAnnotations([this, adder, arch = pdbFile->GetArchitecture()](const PdbSymbol &sym) -> bool
-        {
-          return EnumerateTrace(sym, arch, adder);
-        });
-      }
+      record->AddFormats(guid, adder);
       return true;
     });
   }
   return true;
 }
 
+// A PDB not in the cache, or changed since, is harvested and stored in it. A
+// cached record keeps the cache file mapped as long as the database needs it.
+std::shared_ptr<const FormatRecord> PdbProvider::Impl::CachedRecord(const fs::path &pdbPath) const
+{
+  PdbStamp stamp;
+  if(!ReadPdbStamp(pdbPath, stamp))
+  {
+    return nullptr;
+  }
+  auto record = cache_->Find(pdbPath, stamp);
+  if(!record)
+  {
+    record = HarvestPdb(fm_, pdbPath, stamp);
+    if(record)
+    {
+      cache_->Store(pdbPath, record);
+    }
+  }
+  return record;
+}
+
 bool PdbProvider::Impl::EnumerateTraces(const SourceFileCallback &sourceFileCb, const TraceGuidCallback &traceGuidCb) const
 {
   // for each PDB in path, get the source file GUIDs
@@ -212,7 +194,12 @@ bool PdbProvider::Impl::EnumerateTraces(const SourceFileCallback &sourceFileCb,
 ///////////////////////
 
 PdbProvider::PdbProvider(const PdbFileManager &fm, const fs::path &pdbFile)
-  : impl_(std::make_unique<PdbProvider::Impl>(fm, pdbFile))
+  : impl_(std::make_unique<PdbProvider::Impl>(fm, pdbFile, nullptr))
+{
+}
+
+PdbProvider::PdbProvider(const PdbFileManager &fm, const fs::path &pdbFile, FormatCache &cache)
+  : impl_(std::make_unique<PdbProvider::Impl>(fm, pdbFile, cache.impl_))
 {
 }
 
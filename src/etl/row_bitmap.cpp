@@ -0,0 +1,400 @@
+#include "stdafx.h"
+#include "row_bitmap.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define AMPP_SSE2_BITMAP
+#endif
+
+namespace etl
+{
+
+namespace
+{
+
+enum class WordOp
+{
+  And,
+  Or,
+  AndNot
+};
+
+// dst = dst op src over a whole block
+template <WordOp Op>
+void CombineWords(std::uint64_t *dst, const std::uint64_t *src, size_t count)
+{
+  size_t i = 0;
+#ifdef AMPP_SSE2_BITMAP
+  for(; i + 2 <= count; i += 2)
+  {
+    auto d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+    auto s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    switch(Op)
+    {
+    case WordOp::And:
+      d = _mm_and_si128(d, s);
+      break;
+    case WordOp::Or:
+      d = _mm_or_si128(d, s);
+      break;
+    case WordOp::AndNot:
+      d = _mm_andnot_si128(s, d);
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), d);
+  }
+#endif
+  for(; i < count; ++i)
+  {
+    switch(Op)
+    {
+    case WordOp::And:
+      dst[i] &= src[i];
+      break;
+    case WordOp::Or:
+      dst[i] |= src[i];
+      break;
+    case WordOp::AndNot:
+      dst[i] &= ~src[i];
+      break;
+    }
+  }
+}
+
+size_t PopCount(std::uint64_t v)
+{
+  v = v - ((v >> 1) & 0x5555555555555555ULL);
+  v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+  v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return static_cast<size_t>((v * 0x0101010101010101ULL) >> 56);
+}
+
+// Clears the bits in [first, last) of a block
+void ClearBits(std::uint64_t *words, size_t first, size_t last)
+{
+  for(auto bit = first; bit < last;)
+  {
+    const auto count = (std::min)(64 - bit % 64, last - bit);
+    const auto mask = count == 64 ? ~0ULL : ((1ULL << count) - 1) << (bit % 64);
+    words[bit / 64] &= ~mask;
+    bit += count;
+  }
+}
+
+} // private namespace
+
+RowBitmap::RowBitmap()
+  : firstBlock_(0)
+{
+}
+
+RowBitmap::RowBitmap(const RowBitmap &other)
+  : firstBlock_(0)
+{
+  *this = other;
+}
+
+RowBitmap &RowBitmap::operator=(const RowBitmap &other)
+{
+  if(this == &other)
+  {
+    return *this;
+  }
+  blocks_.clear();
+  blocks_.resize(other.blocks_.size());
+  firstBlock_ = other.firstBlock_;
+  for(size_t b = 0; b < blocks_.size(); ++b)
+  {
+    blocks_[b].state = other.blocks_[b].state;
+    if(other.blocks_[b].words)
+    {
+      blocks_[b].words = std::make_unique<Words>(*other.blocks_[b].words);
+    }
+  }
+  return *this;
+}
+
+RowBitmap::Block &RowBitmap::GetBlock(size_t block)
+{
+  if(blocks_.empty())
+  {
+    firstBlock_ = block;
+  }
+  for(; block < firstBlock_; --firstBlock_)
+  {
+    blocks_.emplace_front();
+  }
+  if(block - firstBlock_ >= blocks_.size())
+  {
+    blocks_.resize(block - firstBlock_ + 1);
+  }
+  return blocks_[block - firstBlock_];
+}
+
+// Blocks outside the ones kept are empty
+const RowBitmap::Block *RowBitmap::FindBlock(size_t block) const
+{
+  if(block < firstBlock_ || block - firstBlock_ >= blocks_.size())
+  {
+    return nullptr;
+  }
+  return &blocks_[block - firstBlock_];
+}
+
+RowBitmap::Words &RowBitmap::MakeMixed(Block &b)
+{
+  if(b.state != BlockState::Mixed)
+  {
+    if(!b.words)
+    {
+      b.words = std::make_unique<Words>();
+    }
+    b.words->fill(b.state == BlockState::Full ? ~0ULL : 0);
+    b.state = BlockState::Mixed;
+  }
+  return *b.words;
+}
+
+void RowBitmap::Normalize(Block &b)
+{
+  if(b.state != BlockState::Mixed)
+  {
+    return;
+  }
+  std::uint64_t any = 0;
+  std::uint64_t all = ~0ULL;
+  for(auto w : *b.words)
+  {
+    any |= w;
+    all &= w;
+  }
+  if(!any)
+  {
+    b.state = BlockState::Empty;
+    b.words.reset();
+  }
+  else if(all == ~0ULL)
+  {
+    b.state = BlockState::Full;
+    b.words.reset();
+  }
+}
+
+void RowBitmap::Set(EventRow row)
+{
+  auto &b = GetBlock(static_cast<size_t>(row / BlockRows));
+  if(b.state == BlockState::Full)
+  {
+    return;
+  }
+  const auto bit = static_cast<size_t>(row % BlockRows);
+  MakeMixed(b)[bit / 64] |= 1ULL << (bit % 64);
+}
+
+void RowBitmap::Reset(EventRow row)
+{
+  const auto block = static_cast<size_t>(row / BlockRows);
+  auto b = FindBlock(block);
+  if(!b || b->state == BlockState::Empty)
+  {
+    return;
+  }
+  const auto bit = static_cast<size_t>(row % BlockRows);
+  MakeMixed(blocks_[block - firstBlock_])[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+bool RowBitmap::Test(EventRow row) const
+{
+  auto b = FindBlock(static_cast<size_t>(row / BlockRows));
+  if(!b)
+  {
+    return false;
+  }
+  if(b->state != BlockState::Mixed)
+  {
+    return b->state == BlockState::Full;
+  }
+  const auto bit = static_cast<size_t>(row % BlockRows);
+  return ((*b->words)[bit / 64] & (1ULL << (bit % 64))) != 0;
+}
+
+// Sets the rows in [first, end) and clears all others
+void RowBitmap::Fill(EventRow first, EventRow end)
+{
+  Clear();
+  if(first >= end)
+  {
+    return;
+  }
+  Reserve(first, end);
+  for(auto &&b : blocks_)
+  {
+    b.state = BlockState::Full;
+  }
+  const auto head = static_cast<size_t>(first % BlockRows);
+  if(head)
+  {
+    ClearBits(MakeMixed(blocks_.front()).data(), 0, head);
+  }
+  const auto tail = static_cast<size_t>(end % BlockRows);
+  if(tail)
+  {
+    ClearBits(MakeMixed(blocks_.back()).data(), tail, BlockRows);
+  }
+}
+
+// Creates the blocks of the rows in [first, end), after that threads may set
+// bits in different blocks concurrently
+void RowBitmap::Reserve(EventRow first, EventRow end)
+{
+  if(first < end)
+  {
+    GetBlock(static_cast<size_t>(first / BlockRows));
+    GetBlock(static_cast<size_t>((end - 1) / BlockRows));
+  }
+}
+
+void RowBitmap::Clear()
+{
+  blocks_.clear();
+  firstBlock_ = 0;
+}
+
+// Releases the blocks below row, which must start a block
+void RowBitmap::ClearBefore(EventRow row)
+{
+  const auto block = static_cast<size_t>(row / BlockRows);
+  for(; firstBlock_ < block && !blocks_.empty(); ++firstBlock_)
+  {
+    blocks_.pop_front();
+  }
+  if(blocks_.empty())
+  {
+    firstBlock_ = 0;
+  }
+}
+
+void RowBitmap::And(const RowBitmap &other)
+{
+  for(auto b = FirstBlock(); b < EndBlock(); ++b)
+  {
+    auto &dst = blocks_[b - firstBlock_];
+    auto src = other.FindBlock(b);
+    if(!src || src->state == BlockState::Empty)
+    {
+      dst.state = BlockState::Empty;
+      dst.words.reset();
+      continue;
+    }
+    if(dst.state == BlockState::Empty || src->state == BlockState::Full)
+    {
+      continue;
+    }
+    if(dst.state == BlockState::Full)
+    {
+      dst.state = BlockState::Mixed;
+      dst.words = std::make_unique<Words>(*src->words);
+      continue;
+    }
+    CombineWords<WordOp::And>(dst.words->data(), src->words->data(), BlockWords);
+    Normalize(dst);
+  }
+}
+
+void RowBitmap::Or(const RowBitmap &other)
+{
+  for(auto b = other.FirstBlock(); b < other.EndBlock(); ++b)
+  {
+    auto &src = other.blocks_[b - other.firstBlock_];
+    if(src.state == BlockState::Empty)
+    {
+      continue;
+    }
+    auto &dst = GetBlock(b);
+    if(dst.state == BlockState::Full)
+    {
+      continue;
+    }
+    if(src.state == BlockState::Full)
+    {
+      dst.state = BlockState::Full;
+      dst.words.reset();
+      continue;
+    }
+    if(dst.state == BlockState::Empty)
+    {
+      dst.state = BlockState::Mixed;
+      dst.words = std::make_unique<Words>(*src.words);
+      continue;
+    }
+    CombineWords<WordOp::Or>(dst.words->data(), src.words->data(), BlockWords);
+    Normalize(dst);
+  }
+}
+
+void RowBitmap::AndNot(const RowBitmap &other)
+{
+  for(auto b = FirstBlock(); b < EndBlock(); ++b)
+  {
+    auto &dst = blocks_[b - firstBlock_];
+    auto src = other.FindBlock(b);
+    if(!src || dst.state == BlockState::Empty || src->state == BlockState::Empty)
+    {
+      continue;
+    }
+    if(src->state == BlockState::Full)
+    {
+      dst.state = BlockState::Empty;
+      dst.words.reset();
+      continue;
+    }
+    CombineWords<WordOp::AndNot>(MakeMixed(dst).data(), src->words->data(), BlockWords);
+    Normalize(dst);
+  }
+}
+
+// Blocks are numbered from row 0, the ones in [FirstBlock(), EndBlock()) are
+// kept
+size_t RowBitmap::FirstBlock() const
+{
+  return firstBlock_;
+}
+
+size_t RowBitmap::EndBlock() const
+{
+  return firstBlock_ + blocks_.size();
+}
+
+size_t RowBitmap::Count() const
+{
+  size_t rv = 0;
+  for(auto b = FirstBlock(); b < EndBlock(); ++b)
+  {
+    rv += CountInBlock(b);
+  }
+  return rv;
+}
+
+size_t RowBitmap::CountInBlock(size_t block) const
+{
+  auto b = FindBlock(block);
+  if(!b)
+  {
+    return 0;
+  }
+  if(b->state == BlockState::Full)
+  {
+    return BlockRows;
+  }
+  size_t rv = 0;
+  if(b->state == BlockState::Mixed)
+  {
+    for(auto w : *b->words)
+    {
+      rv += PopCount(w);
+    }
+  }
+  return rv;
+}
+
+} // namespace etl
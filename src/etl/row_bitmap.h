@@ -0,0 +1,110 @@
+#pragma once
+#include "trace_event_store.h"
+
+namespace etl
+{
+
+inline DWORD LowestSetBit(std::uint64_t v)
+{
+  DWORD rv;
+#ifdef _M_X64
+  _BitScanForward64(&rv, v);
+#else
+  if(!_BitScanForward(&rv, static_cast<DWORD>(v)))
+  {
+    _BitScanForward(&rv, static_cast<DWORD>(v >> 32));
+    rv += 32;
+  }
+#endif
+  return rv;
+}
+
+// One bit per store row. Each chunk's worth of rows is either all clear, all
+// set or a dense block of words, so the common uniform cases cost nothing to
+// store or combine. Blocks are kept from the first one in use, those of
+// evicted rows are released by ClearBefore().
+class RowBitmap
+{
+public:
+  static const size_t BlockRows = EventChunk::Capacity;
+  static const size_t BlockWords = BlockRows / 64;
+  //
+  RowBitmap();
+  RowBitmap(const RowBitmap &other);
+  RowBitmap &operator=(const RowBitmap &other);
+  RowBitmap(RowBitmap &&) = default;
+  RowBitmap &operator=(RowBitmap &&) = default;
+  void Set(EventRow row);
+  void Reset(EventRow row);
+  bool Test(EventRow row) const;
+  void Fill(EventRow first, EventRow end);
+  void Reserve(EventRow first, EventRow end);
+  void Clear();
+  void ClearBefore(EventRow row);
+  void And(const RowBitmap &other);
+  void Or(const RowBitmap &other);
+  void AndNot(const RowBitmap &other);
+  size_t Count() const;
+  size_t CountInBlock(size_t block) const;
+  size_t FirstBlock() const;
+  size_t EndBlock() const;
+  template <class F>
+  void ForEach(F &&f) const;
+  template <class F>
+  void ForEachInBlock(size_t block, F &&f) const;
+private:
+  enum class BlockState : std::uint8_t
+  {
+    Empty,
+    Full,
+    Mixed
+  };
+  using Words = std::array<std::uint64_t, BlockWords>;
+  struct Block
+  {
+    BlockState state;
+    std::unique_ptr<Words> words;
+  };
+  Block &GetBlock(size_t block);
+  const Block *FindBlock(size_t block) const;
+  static Words &MakeMixed(Block &b);
+  static void Normalize(Block &b);
+private:
+  std::deque<Block> blocks_;
+  size_t firstBlock_;
+};
+
+template <class F>
+void RowBitmap::ForEach(F &&f) const
+{
+  for(auto b = FirstBlock(); b < EndBlock(); ++b)
+  {
+    ForEachInBlock(b, f);
+  }
+}
+
+template <class F>
+void RowBitmap::ForEachInBlock(size_t b, F &&f) const
+{
+  const auto base = static_cast<EventRow>(b) * BlockRows;
+  auto &block = blocks_[b - firstBlock_];
+  if(block.state == BlockState::Full)
+  {
+    for(EventRow i = 0; i < BlockRows; ++i)
+    {
+      f(base + i);
+    }
+  }
+  else if(block.state == BlockState::Mixed)
+  {
+    for(size_t w = 0; w < BlockWords; ++w)
+    {
+      for(auto bits = (*block.words)[w]; bits; bits &= bits - 1)
+      {
+        f(base + static_cast<EventRow>(w * 64 + LowestSetBit(bits)));
+      }
+    }
+  }
+}
+
+} // namespace etl
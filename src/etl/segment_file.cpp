@@ -0,0 +1,147 @@
+#include "stdafx.h"
+#include "segment_file.h"
+
+namespace etl
+{
+
+namespace
+{
+
+// views have to start on the allocation granularity, which is 64K on every
+// Windows version
+const std::uint64_t ViewAlignment = 64 * 1024;
+
+} // private namespace
+
+SegmentFile::SegmentFile()
+  : file_(INVALID_HANDLE_VALUE)
+  , mapping_(nullptr)
+  , mappedSize_(0)
+  , size_(0)
+{
+}
+
+SegmentFile::~SegmentFile()
+{
+  Close();
+}
+
+bool SegmentFile::Open(const fs::path &directory)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  if(file_ != INVALID_HANDLE_VALUE)
+  {
+    return true;
+  }
+  fs::path dir(directory);
+  if(dir.empty())
+  {
+    wchar_t tempPath[MAX_PATH + 1];
+    if(!GetTempPathW(MAX_PATH + 1, tempPath))
+    {
+      return false;
+    }
+    dir = tempPath;
+  }
+  wchar_t fileName[MAX_PATH];
+  if(!GetTempFileNameW(dir.c_str(), L"amp", 0, fileName))
+  {
+    return false;
+  }
+  file_ = CreateFileW(fileName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+  size_ = 0;
+  return file_ != INVALID_HANDLE_VALUE;
+}
+
+void SegmentFile::Close()
+{
+  std::lock_guard<std::mutex> l(lock_);
+  if(mapping_)
+  {
+    CloseHandle(mapping_);
+    mapping_ = nullptr;
+  }
+  if(file_ != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+  }
+  mappedSize_ = 0;
+  size_ = 0;
+}
+
+bool SegmentFile::IsOpen() const
+{
+  std::lock_guard<std::mutex> l(lock_);
+  return file_ != INVALID_HANDLE_VALUE;
+}
+
+std::uint64_t SegmentFile::Size() const
+{
+  std::lock_guard<std::mutex> l(lock_);
+  return size_;
+}
+
+bool SegmentFile::Append(const void *data, size_t length, std::uint64_t *offset)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  if(file_ == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  auto cur = static_cast<const std::uint8_t *>(data);
+  auto left = length;
+  while(left > 0)
+  {
+    DWORD chunk = static_cast<DWORD>(__min(left, static_cast<size_t>(0x40000000)));
+    DWORD written = 0;
+    if(!WriteFile(file_, cur, chunk, &written, nullptr) || written == 0)
+    {
+      // a partly written record is never referenced, the next one simply
+      // starts after it
+      size_ += length - left;
+      return false;
+    }
+    cur += written;
+    left -= written;
+  }
+  *offset = size_;
+  size_ += length;
+  return true;
+}
+
+// Maps a record written before. The view stays valid as long as the returned
+// pointer, or a copy of it, is held.
+std::shared_ptr<const std::uint8_t> SegmentFile::Map(std::uint64_t offset, size_t length) const
+{
+  std::lock_guard<std::mutex> l(lock_);
+  if(file_ == INVALID_HANDLE_VALUE || offset + length > size_)
+  {
+    return nullptr;
+  }
+  // a mapping object only covers the file as it was when it was created,
+  // views mapped from an older one keep it alive on their own
+  if(offset + length > mappedSize_)
+  {
+    if(mapping_)
+    {
+      CloseHandle(mapping_);
+    }
+    mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    mappedSize_ = mapping_ ? size_ : 0;
+    if(!mapping_)
+    {
+      return nullptr;
+    }
+  }
+  const auto base = offset - offset % ViewAlignment;
+  auto view = MapViewOfFile(mapping_, FILE_MAP_READ, static_cast<DWORD>(base >> 32), static_cast<DWORD>(base), static_cast<SIZE_T>(offset - base + length));
+  if(!view)
+  {
+    return nullptr;
+  }
+  std::shared_ptr<const std::uint8_t> owner(static_cast<const std::uint8_t *>(view), [](const std::uint8_t *p) { UnmapViewOfFile(p); });
+  return std::shared_ptr<const std::uint8_t>(owner, owner.get() + (offset - base));
+}
+
+} // namespace etl
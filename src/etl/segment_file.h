@@ -0,0 +1,30 @@
+#pragma once
+
+namespace etl
+{
+
+// Append only scratch file for events moved out of memory. Records are
+// written once and read back through a read only file mapping, the file is
+// deleted when it is closed.
+class SegmentFile
+{
+public:
+  SegmentFile();
+  ~SegmentFile();
+  SegmentFile(const SegmentFile &) = delete;
+  SegmentFile &operator=(const SegmentFile &) = delete;
+  bool Open(const fs::path &directory);
+  void Close();
+  bool IsOpen() const;
+  std::uint64_t Size() const;
+  bool Append(const void *data, size_t length, std::uint64_t *offset);
+  std::shared_ptr<const std::uint8_t> Map(std::uint64_t offset, size_t length) const;
+private:
+  HANDLE file_;
+  mutable HANDLE mapping_;
+  mutable std::uint64_t mappedSize_;
+  std::uint64_t size_;
+  mutable std::mutex lock_;
+};
+
+} // namespace etl
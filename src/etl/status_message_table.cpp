@@ -0,0 +1,194 @@
+#include "stdafx.h"
+#include <ampp/etl/status_message_table.h>
+#include <ampp/etl/string_util.h>
+#include "number_util.h"
+#include "file_util.h"
+
+namespace etl
+{
+
+namespace
+{
+
+std::optional<std::wstring> GetSystemMessageString(DWORD s)
+{
+  LPWSTR msgBuf = nullptr;
+  DWORD langId = MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US); //MAKELANGID(LANG_NEUTRAL, SUBLANG_NEUTRAL);
+  auto len = FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_FROM_HMODULE | FORMAT_MESSAGE_IGNORE_INSERTS,
+                            GetModuleHandleW(L"ntdll.dll"),
+                            s,
+                            langId,
+                            reinterpret_cast<LPWSTR>(&msgBuf),
+                            0,
+                            NULL);
+  if(!msgBuf)
+  {
+    return {};
+  }
+  std::wstring rv(msgBuf, len);
+  LocalFree(msgBuf);
+  TrimR(rv);
+  return rv;
+}
+
+} // private namespace
+
+class StatusMessageTable::Impl
+{
+public:
+  Impl();
+  const std::wstring &Lookup(DWORD code);
+  void Add(DWORD code, const std::wstring &message);
+  bool Load(const fs::path &tablePath);
+  bool Save(const fs::path &tablePath) const;
+  void EnableSystemMessages(bool enable);
+private:
+  std::wstring Resolve(DWORD code) const;
+private:
+  // node based, so references to the text survive later inserts
+  std::unordered_map<DWORD, std::wstring> messages_;
+  mutable std::shared_mutex lock_;
+  std::atomic<bool> systemMessages_;
+};
+
+StatusMessageTable::Impl::Impl()
+  : systemMessages_(true)
+{
+}
+
+const std::wstring &StatusMessageTable::Impl::Lookup(DWORD code)
+{
+  {
+    std::shared_lock<std::shared_mutex> l(lock_);
+    auto it = messages_.find(code);
+    if(it != messages_.end())
+    {
+      return it->second;
+    }
+  }
+  auto msg = Resolve(code);
+  std::unique_lock<std::shared_mutex> l(lock_);
+  return messages_.emplace(code, std::move(msg)).first->second;
+}
+
+std::wstring StatusMessageTable::Impl::Resolve(DWORD code) const
+{
+  if(systemMessages_)
+  {
+    auto msg = GetSystemMessageString(code);
+    if(msg)
+    {
+      return *msg;
+    }
+  }
+  std::wstring rv;
+  AppendHex(rv, code, 0, true);
+  return rv;
+}
+
+void StatusMessageTable::Impl::Add(DWORD code, const std::wstring &message)
+{
+  std::unique_lock<std::shared_mutex> l(lock_);
+  // text already returned by Lookup must stay valid, so the first entry wins
+  messages_.emplace(code, message);
+}
+
+// Table files are UTF-8 text, one "<hex code>\t<message>" entry per line
+bool StatusMessageTable::Impl::Load(const fs::path &tablePath)
+{
+  auto fileData = ReadWholeFile<char>(tablePath);
+  if(fileData.empty())
+  {
+    return false;
+  }
+  const char *it = &fileData[0];
+  const char *end = it + fileData.size();
+  auto lines = Split<char>(it, end, '\n');
+  for(auto &&line : lines)
+  {
+    TrimR(line);
+    auto tab = line.find('\t');
+    if(tab == std::string::npos)
+    {
+      continue;
+    }
+    auto code = static_cast<DWORD>(std::strtoul(line.c_str(), nullptr, 16));
+    std::wstring message;
+    AppendUtf8(message, line.data() + tab + 1, line.size() - tab - 1);
+    Add(code, message);
+  }
+  return true;
+}
+
+bool StatusMessageTable::Impl::Save(const fs::path &tablePath) const
+{
+  std::map<DWORD, std::wstring> sorted;
+  {
+    std::shared_lock<std::shared_mutex> l(lock_);
+    sorted.insert(messages_.begin(), messages_.end());
+  }
+  std::string data;
+  for(auto &&kv : sorted)
+  {
+    std::wstring line;
+    AppendHex(line, kv.first, 8, true);
+    line += L'\t';
+    // messages are single line in the table file
+    for(auto c : kv.second)
+    {
+      line += c == L'\r' || c == L'\n' ? L' ' : c;
+    }
+    line += L'\n';
+    AppendAsUtf8(data, line.data(), line.size());
+  }
+  return WriteWholeFile(tablePath, data.data(), data.size());
+}
+
+void StatusMessageTable::Impl::EnableSystemMessages(bool enable)
+{
+  systemMessages_ = enable;
+}
+
+/////////////////////////
+
+StatusMessageTable::StatusMessageTable()
+  : impl_(std::make_unique<StatusMessageTable::Impl>())
+{
+}
+
+StatusMessageTable::~StatusMessageTable()
+{
+}
+
+StatusMessageTable &StatusMessageTable::Default()
+{
+  static StatusMessageTable table;
+  return table;
+}
+
+const std::wstring &StatusMessageTable::Lookup(DWORD code) const
+{
+  return impl_->Lookup(code);
+}
+
+void StatusMessageTable::Add(DWORD code, const std::wstring &message)
+{
+  impl_->Add(code, message);
+}
+
+bool StatusMessageTable::Load(const fs::path &tablePath)
+{
+  return impl_->Load(tablePath);
+}
+
+bool StatusMessageTable::Save(const fs::path &tablePath) const
+{
+  return impl_->Save(tablePath);
+}
+
+void StatusMessageTable::EnableSystemMessages(bool enable)
+{
+  impl_->EnableSystemMessages(enable);
+}
+
+} // namespace etl
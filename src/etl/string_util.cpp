@@ -1,5 +1,9 @@
 #include "stdafx.h"
 #include <ampp/etl/string_util.h>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define AMPP_SSE2_TRANSCODE
+#endif
 
 namespace etl
 {
@@ -144,6 +148,157 @@ std::vector<std::basic_string<CharT>> Split(const std::basic_string<CharT> &s, c
   return rv;
 }
 
+namespace
+{
+
+const wchar_t ReplacementChar = 0xFFFD;
+
+bool IsContinuation(unsigned char c)
+{
+  return (c & 0xC0) == 0x80;
+}
+
+// Decodes one multi-byte sequence starting at s, returns the number of bytes consumed
+size_t DecodeUtf8Sequence(const unsigned char *s, const unsigned char *end, wchar_t *&dst)
+{
+  const auto c = s[0];
+  size_t len = 0;
+  std::uint32_t cp = 0;
+  std::uint32_t minCp = 0;
+  if(c >= 0xC2 && c <= 0xDF)
+  {
+    len = 2;
+    cp = c & 0x1F;
+    minCp = 0x80;
+  }
+  else if(c >= 0xE0 && c <= 0xEF)
+  {
+    len = 3;
+    cp = c & 0x0F;
+    minCp = 0x800;
+  }
+  else if(c >= 0xF0 && c <= 0xF4)
+  {
+    len = 4;
+    cp = c & 0x07;
+    minCp = 0x10000;
+  }
+  else
+  {
+    *dst++ = ReplacementChar;
+    return 1;
+  }
+  if(static_cast<size_t>(end - s) < len)
+  {
+    *dst++ = ReplacementChar;
+    return 1;
+  }
+  for(size_t n = 1; n < len; ++n)
+  {
+    if(!IsContinuation(s[n]))
+    {
+      *dst++ = ReplacementChar;
+      return n;
+    }
+    cp = (cp << 6) | (s[n] & 0x3F);
+  }
+  if(cp < minCp || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+  {
+    *dst++ = ReplacementChar;
+    return len;
+  }
+  if(cp >= 0x10000)
+  {
+    cp -= 0x10000;
+    *dst++ = static_cast<wchar_t>(0xD800 + (cp >> 10));
+    *dst++ = static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+  }
+  else
+  {
+    *dst++ = static_cast<wchar_t>(cp);
+  }
+  return len;
+}
+
+} // private namespace
+
+void AppendUtf8(std::wstring &out, const char *s, size_t length)
+{
+  // UTF-16 never needs more code units than UTF-8 needs bytes
+  const auto start = out.size();
+  out.resize(start + length);
+  wchar_t *dst = &out[0] + start;
+  auto cur = reinterpret_cast<const unsigned char *>(s);
+  const auto end = cur + length;
+  while(cur != end)
+  {
+#ifdef AMPP_SSE2_TRANSCODE
+    static_assert(sizeof(wchar_t) == 2, "SSE2 widening assumes UTF-16 wchar_t");
+    const auto zero = _mm_setzero_si128();
+    while(end - cur >= 16)
+    {
+      auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+      if(_mm_movemask_epi8(bytes) != 0)
+      {
+        break;
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi8(bytes, zero));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), _mm_unpackhi_epi8(bytes, zero));
+      cur += 16;
+      dst += 16;
+    }
+#endif
+    while(cur != end && *cur < 0x80)
+    {
+      *dst++ = *cur++;
+    }
+    if(cur != end)
+    {
+      cur += DecodeUtf8Sequence(cur, end, dst);
+    }
+  }
+  out.resize(dst - &out[0]);
+}
+
+void AppendAsUtf8(std::string &out, const wchar_t *s, size_t length)
+{
+  const auto end = s + length;
+  while(s != end)
+  {
+    std::uint32_t cp = static_cast<std::uint16_t>(*s++);
+    if(cp >= 0xD800 && cp <= 0xDBFF && s != end && *s >= 0xDC00 && *s <= 0xDFFF)
+    {
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (*s++ - 0xDC00);
+    }
+    else if(cp >= 0xD800 && cp <= 0xDFFF)
+    {
+      cp = ReplacementChar;
+    }
+    if(cp < 0x80)
+    {
+      out += static_cast<char>(cp);
+    }
+    else if(cp < 0x800)
+    {
+      out += static_cast<char>(0xC0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else if(cp < 0x10000)
+    {
+      out += static_cast<char>(0xE0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+      out += static_cast<char>(0xF0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+}
+
 void Skip(const wchar_t *&fmtLine, const wchar_t *endFmtLine, wchar_t ch)
 {
   while(fmtLine != endFmtLine && *fmtLine == ch)
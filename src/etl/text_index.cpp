@@ -0,0 +1,179 @@
+#include "stdafx.h"
+#include "text_index.h"
+
+namespace etl
+{
+
+namespace
+{
+
+const size_t GramLength = 3;
+
+std::uint64_t GramKey(const wchar_t *s)
+{
+  std::uint64_t rv = 0;
+  for(size_t i = 0; i < GramLength; ++i)
+  {
+    rv = (rv << 16) | static_cast<std::uint16_t>(towlower(s[i]));
+  }
+  return rv;
+}
+
+void AddPosting(std::vector<EventRow> &rows, EventRow row)
+{
+  if(rows.empty() || rows.back() < row)
+  {
+    rows.push_back(row);
+    return;
+  }
+  auto it = std::lower_bound(rows.begin(), rows.end(), row);
+  if(*it != row)
+  {
+    rows.insert(it, row);
+  }
+}
+
+bool IsWordChar(wchar_t c)
+{
+  return iswalnum(c) || c == L'_';
+}
+
+} // private namespace
+
+void TextIndex::AddTo(Postings &postings, EventRow row, const std::wstring &text)
+{
+  for(size_t i = 0; i + GramLength <= text.length(); ++i)
+  {
+    AddPosting(postings[GramKey(text.c_str() + i)], row);
+  }
+}
+
+void TextIndex::Add(EventRow row, const std::wstring &text)
+{
+  std::unique_lock<std::shared_mutex> l(lock_);
+  AddTo(postings_, row, text);
+}
+
+void TextIndex::AddUnresolved(EventRow row)
+{
+  std::unique_lock<std::shared_mutex> l(lock_);
+  AddPosting(unresolved_, row);
+}
+
+// Indexes a row added by AddUnresolved(), other rows are left alone
+void TextIndex::Resolve(EventRow row, const std::wstring &text)
+{
+  std::unique_lock<std::shared_mutex> l(lock_);
+  auto it = std::lower_bound(unresolved_.begin(), unresolved_.end(), row);
+  if(it == unresolved_.end() || *it != row)
+  {
+    return;
+  }
+  unresolved_.erase(it);
+  AddTo(postings_, row, text);
+}
+
+void TextIndex::Merge(Postings &&postings)
+{
+  std::unique_lock<std::shared_mutex> l(lock_);
+  for(auto &&kv : postings)
+  {
+    auto &rows = postings_[kv.first];
+    if(rows.empty())
+    {
+      rows = std::move(kv.second);
+    }
+    else if(rows.back() < kv.second.front())
+    {
+      rows.insert(rows.end(), kv.second.begin(), kv.second.end());
+    }
+    else
+    {
+      auto mid = rows.insert(rows.end(), kv.second.begin(), kv.second.end());
+      std::inplace_merge(rows.begin(), mid, rows.end());
+      rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    }
+  }
+}
+
+void TextIndex::Clear()
+{
+  std::unique_lock<std::shared_mutex> l(lock_);
+  postings_.clear();
+  unresolved_.clear();
+}
+
+void TextIndex::RemoveBefore(EventRow end)
+{
+  std::unique_lock<std::shared_mutex> l(lock_);
+  for(auto it = postings_.begin(); it != postings_.end();)
+  {
+    auto &rows = it->second;
+    rows.erase(rows.begin(), std::lower_bound(rows.begin(), rows.end(), end));
+    it = rows.empty() ? postings_.erase(it) : std::next(it);
+  }
+  unresolved_.erase(unresolved_.begin(), std::lower_bound(unresolved_.begin(), unresolved_.end(), end));
+}
+
+// Rows that contain every trigram of text, in row order, and the unresolved
+// rows that may contain it too. Returns false when text is too short to be
+// looked up.
+bool TextIndex::Candidates(const std::wstring &text, std::vector<EventRow> &rows, std::vector<EventRow> &unresolved) const
+{
+  rows.clear();
+  unresolved.clear();
+  if(text.length() < GramLength)
+  {
+    return false;
+  }
+  std::shared_lock<std::shared_mutex> l(lock_);
+  unresolved = unresolved_;
+  std::vector<const std::vector<EventRow> *> lists;
+  for(size_t i = 0; i + GramLength <= text.length(); ++i)
+  {
+    auto it = postings_.find(GramKey(text.c_str() + i));
+    if(it == postings_.end())
+    {
+      return true;
+    }
+    lists.push_back(&it->second);
+  }
+  // intersect the shortest lists first so the working set shrinks quickly
+  std::sort(lists.begin(), lists.end(), [](const std::vector<EventRow> *l, const std::vector<EventRow> *r) { return l->size() < r->size(); });
+  lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+  rows = *lists.front();
+  std::vector<EventRow> tmp;
+  for(size_t i = 1; i < lists.size() && !rows.empty(); ++i)
+  {
+    tmp.clear();
+    std::set_intersection(rows.begin(), rows.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(tmp));
+    rows.swap(tmp);
+  }
+  return true;
+}
+
+bool ContainsText(const std::wstring &haystack, const std::wstring &lowerNeedle, bool wholeWord)
+{
+  auto begin = haystack.begin();
+  for(;;)
+  {
+    auto it = std::search(begin, haystack.end(), lowerNeedle.begin(), lowerNeedle.end(),
+      [](wchar_t h, wchar_t n) { return towlower(h) == n; });
+    if(it == haystack.end())
+    {
+      return false;
+    }
+    if(!wholeWord)
+    {
+      return true;
+    }
+    auto end = it + lowerNeedle.length();
+    if((it == haystack.begin() || !IsWordChar(*(it - 1))) && (end == haystack.end() || !IsWordChar(*end)))
+    {
+      return true;
+    }
+    begin = it + 1;
+  }
+}
+
+} // namespace etl
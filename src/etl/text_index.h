@@ -0,0 +1,32 @@
+#pragma once
+#include "trace_event_store.h"
+
+namespace etl
+{
+
+// Trigram postings over lower cased message text. A substring query only has
+// to look at the rows that contain every trigram of the searched text, and at
+// the rows that had no provider when they were indexed. Those are indexed once
+// a search finds them decoded.
+class TextIndex
+{
+public:
+  using Postings = std::unordered_map<std::uint64_t, std::vector<EventRow>>;
+  //
+  void Add(EventRow row, const std::wstring &text);
+  void AddUnresolved(EventRow row);
+  void Resolve(EventRow row, const std::wstring &text);
+  void Merge(Postings &&postings);
+  void Clear();
+  void RemoveBefore(EventRow end);
+  bool Candidates(const std::wstring &text, std::vector<EventRow> &rows, std::vector<EventRow> &unresolved) const;
+  static void AddTo(Postings &postings, EventRow row, const std::wstring &text);
+private:
+  Postings postings_;
+  std::vector<EventRow> unresolved_;
+  mutable std::shared_mutex lock_;
+};
+
+bool ContainsText(const std::wstring &haystack, const std::wstring &lowerNeedle, bool wholeWord);
+
+} // namespace etl
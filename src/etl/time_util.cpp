@@ -61,6 +61,19 @@ int FileTimeCmp(const FILETIME &lhs, const FILETIME &rhs)
   return memcmp(&lhs, &rhs, sizeof(FILETIME));
 }
 
+std::uint64_t FileTimeToTicks(const FILETIME &ft)
+{
+  return (static_cast<std::uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+FILETIME TicksToFileTime(std::uint64_t ticks)
+{
+  FILETIME rv;
+  rv.dwHighDateTime = static_cast<DWORD>(ticks >> 32);
+  rv.dwLowDateTime = static_cast<DWORD>(ticks);
+  return rv;
+}
+
 std::wstring FormatFileTime(const wchar_t *fmt, const FILETIME &ft)
 {
   std::wstring rv;
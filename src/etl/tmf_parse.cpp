@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "tmf_parse.h"
+#include <ampp/etl/guid_util.h>
+#include <ampp/etl/string_util.h>
+
+namespace etl
+{
+
+namespace
+{
+
+bool ParseFormatStr(const wchar_t *&fmtLine, const wchar_t *endFmtLine, std::wstring &fmtString)
+{
+  auto cur = fmtLine;
+  //auto last = fmtLine + wcslen(fmtLine);
+  auto first = std::find(cur, endFmtLine, L'\"');
+  if(first == endFmtLine)
+  {
+    return false;
+  }
+  ++first;
+  std::reverse_iterator<const wchar_t *> begin(endFmtLine);
+  std::reverse_iterator<const wchar_t *> end(first);
+  auto final = std::find(begin, end, L'\"');
+  if(final == end)
+  {
+    return false;
+  }
+  ++final;
+  auto endOfString = final.base();
+  fmtString.assign(first, endOfString);
+  fmtLine = __min(endOfString + 2, endFmtLine);
+  return true;
+}
+
+} // private namespace
+
+// Settings without a value, like MJ=, are kept with an empty one
+ConfigMap SplitConfig(const wchar_t *&cur, const wchar_t *end)
+{
+  ConfigMap rv;
+  auto vv = Split(cur, end, L' ');
+  for(auto &&cv : vv)
+  {
+    auto cfg = Split(cv, L'=');
+    if(!cfg.empty())
+    {
+      rv.emplace(cfg[0], cfg.size() > 1 ? cfg[1] : std::wstring());
+    }
+  }
+  return rv;
+}
+
+bool ParseModuleLine(const wchar_t *modLine, GUID &fileGuid, std::wstring &moduleName, ConfigMap &cfgMap)
+{
+  auto cur = modLine;
+  auto last = modLine + wcslen(modLine);
+  auto guid = CopyUntil(cur, last, L' ');
+  Skip(cur, last, L' ');
+  moduleName = CopyUntil(cur, last, L' ');
+  Skip(cur, last, L' ');
+  Skip(cur, last, L'/');
+  Skip(cur, last, L' ');
+  cfgMap = SplitConfig(cur, last);
+  return GuidFromString(guid, &fileGuid);
+}
+
+bool ParseFormatLine(const wchar_t *fmtLine, std::wstring &fmtString, ConfigMap &cfgMap, DWORD &traceIndex)
+{
+  auto cur = fmtLine;
+  auto last = fmtLine + wcslen(fmtLine);
+  // skip #typev
+  SkipUntil(cur, last, L' ');
+  Skip(cur, last, L' ');
+  // skip <id>
+  SkipUntil(cur, last, L' ');
+  Skip(cur, last, L' ');
+  // get trace index
+  traceIndex = wcstoul(cur, nullptr, 10);
+  if(!ParseFormatStr(cur, last, fmtString))
+  {
+    return false;
+  }
+  Skip(cur, last, L' ');
+  Skip(cur, last, L'/');
+  Skip(cur, last, L' ');
+  cfgMap = SplitConfig(cur, last);
+  return true;
+}
+
+// Message ids are the source file name and extension followed by the line,
+// as in main_c120
+DWORD ParseLineNumber(const wchar_t *fmtLine)
+{
+  auto cur = fmtLine;
+  auto last = fmtLine + wcslen(fmtLine);
+  SkipUntil(cur, last, L' ');
+  Skip(cur, last, L' ');
+  auto id = CopyUntil(cur, last, L' ');
+  auto digits = id.size();
+  while(digits > 0 && iswdigit(id[digits - 1]))
+  {
+    --digits;
+  }
+  return wcstoul(id.c_str() + digits, nullptr, 10);
+}
+
+// The argument is an expression from the source and may contain ", " itself,
+// so the line is split at the last one
+bool ParseTypeLine(const wchar_t *typeLine, DWORD &index, TypeValue &typeValue)
+{
+  std::wstring line(typeLine);
+  TrimR(line);
+  const auto comma = line.rfind(L", ");
+  const auto dashes = line.rfind(L" -- ");
+  if(comma == std::wstring::npos || dashes == std::wstring::npos || dashes < comma)
+  {
+    return false;
+  }
+  typeValue.argName = line.substr(0, comma);
+  typeValue.type = line.substr(comma + 2, dashes - comma - 2);
+  index = wcstoul(line.c_str() + dashes + 4, nullptr, 10);
+  return true;
+}
+
+} // namespace etl
@@ -0,0 +1,21 @@
+#pragma once
+#include "trace_format_impl.h"
+
+namespace etl
+{
+
+// The lines of the TMF text tracewpp emits. PDBs carry them in TMF:
+// annotations, one string per line, .tmf files have them as text.
+//
+// <file guid> <module> // SRC=<source file> MJ= MN=
+// #typev <message id> <trace index> "<format>" // LEVEL=... FUNC=...
+// {
+// <argument>, <type> -- <index>
+// }
+ConfigMap SplitConfig(const wchar_t *&cur, const wchar_t *end);
+bool ParseModuleLine(const wchar_t *modLine, GUID &fileGuid, std::wstring &moduleName, ConfigMap &cfgMap);
+bool ParseFormatLine(const wchar_t *fmtLine, std::wstring &fmtString, ConfigMap &cfgMap, DWORD &traceIndex);
+DWORD ParseLineNumber(const wchar_t *fmtLine);
+bool ParseTypeLine(const wchar_t *typeLine, DWORD &index, TypeValue &typeValue);
+
+} // namespace etl
@@ -0,0 +1,220 @@
+#include "stdafx.h"
+#include <ampp/etl/tmf_provider.h>
+#include <ampp/etl/guid_util.h>
+#include <ampp/etl/string_util.h>
+#include "file_util.h"
+#include "parallel_util.h"
+#include "tmf_parse.h"
+
+namespace etl
+{
+
+namespace
+{
+
+// The formats of one .tmf file, tracepdb writes one per source file
+struct TmfFile
+{
+  GUID fileGuid;
+  std::wstring sourcePath;
+  std::vector<TraceFormat> formats;
+};
+
+bool StartsWith(const std::wstring &line, const wchar_t *prefix)
+{
+  return line.compare(0, wcslen(prefix), prefix) == 0;
+}
+
+// TMF files are plain ASCII as tracepdb writes them, reading them as UTF-8
+// also covers hand edited ones
+std::shared_ptr<const TmfFile> ReadTmfFile(const fs::path &tmfPath, Architecture arch)
+{
+  size_t size;
+  auto data = MapWholeFile(tmfPath, size);
+  if(!data)
+  {
+    return nullptr;
+  }
+  auto text = reinterpret_cast<const char *>(data.get());
+  if(size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0)
+  {
+    text += 3;
+    size -= 3;
+  }
+  std::wstring content;
+  AppendUtf8(content, text, size);
+  data.reset();
+  auto file = std::make_shared<TmfFile>();
+  std::wstring moduleName;
+  bool haveModule = false;
+  bool inTypes = false;
+  TraceFormat *current = nullptr;
+  const wchar_t *cur = content.c_str();
+  const wchar_t *end = cur + content.size();
+  while(cur != end)
+  {
+    Skip(cur, end, L' ');
+    Skip(cur, end, L'\t');
+    auto line = CopyUntil(cur, end, L'\n');
+    Skip(cur, end, L'\n');
+    TrimR(line);
+    if(line.empty() || StartsWith(line, L"//"))
+    {
+      continue;
+    }
+    if(inTypes)
+    {
+      DWORD index;
+      TypeValue tv;
+      if(line == L"}")
+      {
+        inTypes = false;
+      }
+      else if(current && ParseTypeLine(line.c_str(), index, tv))
+      {
+        current->typeMap.emplace(index, std::move(tv));
+      }
+    }
+    else if(line == L"{")
+    {
+      inTypes = true;
+    }
+    else if(StartsWith(line, L"#typev"))
+    {
+      file->formats.emplace_back();
+      current = &file->formats.back();
+      if(!ParseFormatLine(line.c_str(), current->formatString, current->traceCfg, current->traceIndex))
+      {
+        file->formats.pop_back();
+        current = nullptr;
+        continue;
+      }
+      current->moduleName = moduleName;
+      current->lineNumber = ParseLineNumber(line.c_str());
+      current->fileInfoFlags = arch == Architecture::X86 ? FIF_32BIT_TRACE : FIF_64BIT_TRACE;
+      auto func = current->traceCfg.find(L"FUNC");
+      if(func != current->traceCfg.end())
+      {
+        current->function = func->second;
+      }
+    }
+    else if(line[0] == L'#')
+    {
+      // enumeration blocks and the like, their braces must not take types
+      current = nullptr;
+    }
+    else if(!haveModule)
+    {
+      ConfigMap modCfg;
+      if(!ParseModuleLine(line.c_str(), file->fileGuid, moduleName, modCfg))
+      {
+        return nullptr;
+      }
+      file->sourcePath = modCfg[L"SRC"];
+      haveModule = true;
+    }
+  }
+  return haveModule ? file : nullptr;
+}
+
+} // private namespace
+
+///////////////////
+
+class TmfProvider::Impl
+{
+public:
+  Impl(const fs::path &tmfPath, Architecture arch);
+  bool EnumerateTraces(const SourceFileCallback &sourceFileCb, const TraceGuidCallback &traceGuidCb) const;
+private:
+  std::vector<fs::path> TmfFiles() const;
+private:
+  fs::path tmfPath_;
+  Architecture arch_;
+};
+
+//////////////////
+
+TmfProvider::Impl::Impl(const fs::path &tmfPath, Architecture arch)
+  : tmfPath_(tmfPath)
+  , arch_(arch)
+{
+}
+
+std::vector<fs::path> TmfProvider::Impl::TmfFiles() const
+{
+  std::vector<fs::path> files;
+  if(fs::is_regular_file(tmfPath_))
+  {
+    files.push_back(tmfPath_);
+  }
+  else if(fs::is_directory(tmfPath_))
+  {
+    fs::directory_iterator di(tmfPath_);
+    fs::directory_iterator end;
+    while(di != end)
+    {
+      if(fs::is_regular_file(di->path()) && _wcsicmp(di->path().extension().c_str(), L".tmf") == 0)
+      {
+        files.push_back(di->path());
+      }
+      ++di;
+    }
+  }
+  return files;
+}
+
+// The files are parsed up front, one per pool thread at a time. What the
+// database asks for later is copied out of the parsed files, which the
+// callbacks keep.
+bool TmfProvider::Impl::EnumerateTraces(const SourceFileCallback &sourceFileCb, const TraceGuidCallback &) const
+{
+  const auto paths = TmfFiles();
+  std::vector<std::shared_ptr<const TmfFile>> files(paths.size());
+  ParallelFor(paths.size(), [this, &paths, &files](size_t index)
+  {
+    files[index] = ReadTmfFile(paths[index], arch_);
+  });
+  GuidKeyedMap<std::vector<std::shared_ptr<const TmfFile>>> sourceFiles;
+  for(auto &&file : files)
+  {
+    if(file)
+    {
+      sourceFiles[file->fileGuid].push_back(file);
+    }
+  }
+  for(auto &&kv : sourceFiles)
+  {
+    sourceFileCb(kv.first, [files = kv.second](const TraceFormatAddCallback &adder)
+    {
+      for(auto &&file : files)
+      {
+        for(auto &&fmt : file->formats)
+        {
+          auto traceFormat = fmt;
+          adder(file->fileGuid, file->sourcePath.c_str(), std::move(traceFormat));
+        }
+      }
+      return true;
+    });
+  }
+  return !sourceFiles.empty();
+}
+
+///////////////////////
+
+TmfProvider::TmfProvider(const fs::path &tmfPath, Architecture arch)
+  : impl_(std::make_unique<TmfProvider::Impl>(tmfPath, arch))
+{
+}
+
+TmfProvider::~TmfProvider()
+{
+}
+
+bool TmfProvider::EnumerateTraces(const SourceFileCallback &sourceFileCb, const TraceGuidCallback &traceGuidCb) const
+{
+  return impl_->EnumerateTraces(sourceFileCb, traceGuidCb);
+}
+
+} // namespace etl
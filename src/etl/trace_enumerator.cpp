@@ -7,6 +7,15 @@
 #include "trace_format_data_impl.h"
 #include "trace_util.h"
 #include "trace_format_impl.h"
+#include "file_util.h"
+#include "trace_event_store.h"
+#include "event_sequence.h"
+#include "row_bitmap.h"
+#include "trace_query.h"
+#include "parallel_util.h"
+#include "text_index.h"
+#include "count_notifier.h"
+#include "guid_table.h"
 
 #include <Evntrace.h>
 
@@ -18,28 +27,78 @@ void Observable::AddObserver(Observer *o) const
 {
   if(o)
   {
-    observers_.push_back(o);
+    std::lock_guard<std::mutex> l(lock_);
+    observers_.push_back(std::make_shared<Entry>(Entry {o}));
   }
 }
 
+// Waits for notifications of o running on other threads, so the observer can
+// go away once this returns. Called from its own Notify() it does not wait
+// for that one.
 void Observable::RemoveObserver(Observer *o) const
 {
-  if(o)
+  if(!o)
+  {
+    return;
+  }
+  std::unique_lock<std::mutex> l(lock_);
+  std::vector<std::shared_ptr<Entry>> removed;
+  for(auto it = observers_.begin(); it != observers_.end();)
+  {
+    if((*it)->observer == o)
+    {
+      (*it)->observer = nullptr;
+      removed.push_back(std::move(*it));
+      it = observers_.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  const auto self = std::this_thread::get_id();
+  for(auto &entry : removed)
   {
-    observers_.remove(o);
+    notified_.wait(l, [&]
+    {
+      auto &notifying = entry->notifying;
+      return std::all_of(notifying.begin(), notifying.end(), [&](std::thread::id id) { return id == self; });
+    });
   }
 }
 
+// The lock is not held while an observer is notified, so Notify() may add or
+// remove observers and a notification on one thread does not hold up the others
 void Observable::NotifyObservers() const
 {
-  auto it = observers_.begin();
-  while(it != observers_.end())
+  std::unique_lock<std::mutex> l(lock_);
+  const std::vector<std::shared_ptr<Entry>> entries(observers_.begin(), observers_.end());
+  const auto self = std::this_thread::get_id();
+  auto done = [&](Entry &entry)
+  {
+    l.lock();
+    entry.notifying.erase(std::find(entry.notifying.begin(), entry.notifying.end(), self));
+    notified_.notify_all();
+  };
+  for(auto &entry : entries)
   {
-    auto tmp = it++;
-    if(*tmp)
+    auto o = entry->observer;
+    if(!o)
+    {
+      continue;
+    }
+    entry->notifying.push_back(self);
+    l.unlock();
+    try
+    {
+      o->Notify(this);
+    }
+    catch(...)
     {
-      (*tmp)->Notify(this);
+      done(*entry);
+      throw;
     }
+    done(*entry);
   }
 }
 
@@ -66,8 +125,6 @@ struct MofDataLive : public MofDataBase
 };
 #pragma pack(pop)
 
-const wchar_t TIME_FORMAT[] = L"Y-M-D H:m:S.l";
-
 FILETIME MofDataFromFile::GetTimeStamp()
 {
   return timeStamp;
@@ -93,17 +150,52 @@ FILETIME MofDataLive::GetTimeStamp()
   return rv;
 }
 
+// The formats of one source file, indexed by trace index. Trace indices are
+// numbered from a small base up, so the index is dense. Lookups read the
+// published index without a lock, it is replaced as a whole after each
+// provider run and the ones replaced are kept, as are the formats.
+// Events carry the trace index in 16 bits, formats with a larger one can never
+// be looked up and are not stored, whatever a TMF file or the cache says.
 struct SourceFile
 {
-  std::map<DWORD, std::unique_ptr<TraceFormat>> traceEvents;
+  static const DWORD MaxTraceIndex = 0xFFFF;
+  using FormatIndex = std::vector<const TraceFormat *>;
+  std::atomic<const FormatIndex *> published;
+  std::vector<std::unique_ptr<FormatIndex>> indices;
+  FormatIndex staged;
+  std::vector<std::unique_ptr<TraceFormat>> traceEvents;
   fs::path filePath;
+  const std::wstring *fileName;
   //std::map<std::wstring, DWORD> traceBits;
   //std::wstring moduleName;
 };
 
+namespace
+{
+
+std::uint64_t NextDatabaseId()
+{
+  static std::atomic<std::uint64_t> nextId(1);
+  return nextId++;
+}
+
+// The source file of the last lookup on this thread. The events of one file
+// tend to come in runs, so most lookups skip the hash table.
+struct LastSourceFile
+{
+  std::uint64_t database;
+  GUID fileGuid;
+  const SourceFile *sourceFile;
+};
+
+thread_local LastSourceFile g_lastSourceFile = {};
+
+} // private namespace
+
 class FormatDatabase::Impl : public Observable
 {
 public:
+  Impl();
   void AddProvider(const GUID &fileGuid, const ProviderCallback &provider);
   const TraceFormat *FindTrace(const GUID &fileGuid, DWORD traceIdx) const;
   fs::path GetSourceFile(const GUID &fileGuid) const;
@@ -111,11 +203,26 @@ public:
   std::vector<GUID> GetTraceProviderGuids() const;
 private:
   const TraceFormat *FindTraceInternal(const GUID &fileGuid, DWORD traceIdx) const;
+  const SourceFile *FindSourceFile(const GUID &fileGuid) const;
+  bool IsUnknownFile(const GUID &fileGuid) const;
+  void SetUnknownFile(const GUID &fileGuid, bool unknown) const;
   void InvokeProvider(const GUID &fileGuid) const;
-  bool AddSourceFileTrace(const GUID &fileGuid, const TraceFormat &fmt) const;
-  void SetSourceFilePath(const GUID &fileGuid, const fs::path &filePath) const;
+  void AddSourceFileTrace(const GUID &fileGuid, const wchar_t *fileName, TraceFormat &&fmt) const;
+  void PublishSourceFiles() const;
+  const std::wstring *Intern(std::wstring &&str) const;
 private:
-  mutable GuidKeyedMap<std::unique_ptr<SourceFile>> sourceFiles_;
+  const std::uint64_t id_;
+  // read without a lock, changed with lock_ held
+  mutable GuidTable<SourceFile *> sourceFiles_;
+  // only used with lock_ held
+  mutable std::vector<std::unique_ptr<SourceFile>> sourceFileStore_;
+  mutable std::vector<SourceFile *> staged_;
+  mutable GuidKeyedMap<std::set<DWORD>> misses_;
+  // files no provider had, read without a lock like sourceFiles_
+  mutable GuidTable<std::atomic<bool> *> unknownFiles_;
+  mutable std::deque<std::atomic<bool>> unknownFlags_;
+  mutable std::set<std::wstring> strings_;
+  mutable std::mutex lock_;
   GuidKeyedMap<ProviderCallback> providers_;
   GuidKeyedMap<std::wstring> traces_;
 };
@@ -123,32 +230,121 @@ private:
 
 //////////////////////////////
 
+FormatDatabase::Impl::Impl()
+  : id_(NextDatabaseId())
+{
+}
+
 void FormatDatabase::Impl::AddProvider(const GUID &fileGuid, const ProviderCallback &provider)
 {
+  std::lock_guard<std::mutex> l(lock_);
   providers_[fileGuid] = provider;
+  // the new provider may know what the old ones did not
+  misses_.erase(fileGuid);
+  SetUnknownFile(fileGuid, false);
+}
+
+const std::wstring *FormatDatabase::Impl::Intern(std::wstring &&str) const
+{
+  return &*strings_.insert(std::move(str)).first;
 }
 
-bool FormatDatabase::Impl::AddSourceFileTrace(const GUID &fileGuid, const TraceFormat &fmt) const
+void FormatDatabase::Impl::AddSourceFileTrace(const GUID &fileGuid, const wchar_t *fileName, TraceFormat &&fmt) const
 {
-  auto it = sourceFiles_.emplace(fileGuid, std::make_unique<SourceFile>());
-  it.first->second->traceEvents[fmt.traceIndex] = std::make_unique<TraceFormat>(fmt);
-  return it.second;
+  if(fmt.traceIndex > SourceFile::MaxTraceIndex)
+  {
+    return;
+  }
+  SourceFile *entry;
+  if(auto found = sourceFiles_.Find(fileGuid))
+  {
+    entry = *found;
+  }
+  else
+  {
+    sourceFileStore_.push_back(std::make_unique<SourceFile>());
+    entry = sourceFileStore_.back().get();
+    entry->published.store(nullptr);
+    entry->filePath = fileName;
+    entry->fileName = Intern(entry->filePath.filename().wstring());
+    // found by lookups only once its index is published
+    sourceFiles_.Insert(fileGuid, entry);
+  }
+  auto &sourceFile = *entry;
+  // decoded events point at the formats, one handed out is never replaced
+  if(fmt.traceIndex < sourceFile.staged.size() && sourceFile.staged[fmt.traceIndex])
+  {
+    return;
+  }
+  auto traceFmt = std::make_unique<TraceFormat>(std::move(fmt));
+  traceFmt->program = CompileTraceFormat(*traceFmt);
+  // the site strings are only read through the interned pointers from here on
+  auto &site = traceFmt->site;
+  site.moduleName = Intern(std::move(traceFmt->moduleName));
+  site.function = Intern(std::move(traceFmt->function));
+  site.lineNumber = Intern(std::to_wstring(traceFmt->lineNumber));
+  site.sourceFile = sourceFile.fileName;
+  site.sourcePath = &sourceFile.filePath;
+  traceFmt->moduleName.clear();
+  traceFmt->function.clear();
+  const auto traceIndex = traceFmt->traceIndex;
+  if(traceIndex >= sourceFile.staged.size())
+  {
+    sourceFile.staged.resize(traceIndex + 1);
+  }
+  if(std::find(staged_.begin(), staged_.end(), entry) == staged_.end())
+  {
+    staged_.push_back(entry);
+  }
+  sourceFile.staged[traceIndex] = traceFmt.get();
+  sourceFile.traceEvents.push_back(std::move(traceFmt));
 }
 
-void FormatDatabase::Impl::SetSourceFilePath(const GUID &fileGuid, const fs::path &filePath) const
+// Makes the formats a provider run added visible to lookups
+void FormatDatabase::Impl::PublishSourceFiles() const
 {
-  sourceFiles_[fileGuid]->filePath = filePath;
+  for(auto sourceFile : staged_)
+  {
+    sourceFile->indices.push_back(std::make_unique<SourceFile::FormatIndex>(sourceFile->staged));
+    sourceFile->published.store(sourceFile->indices.back().get(), std::memory_order_release);
+  }
+  staged_.clear();
 }
 
+// Lookups of known formats take no lock, so any number of enumerators can
+// decode with one database. Misses are serialized, the first one runs the
+// provider and the others find what it added. A format the provider did not
+// have is remembered as missing until a provider for its file is added, a
+// file it did not know at all is turned away without the lock.
 const TraceFormat *FormatDatabase::Impl::FindTrace(const GUID &fileGuid, DWORD traceIdx) const
 {
   auto rv = FindTraceInternal(fileGuid, traceIdx);
+  if (rv || IsUnknownFile(fileGuid))
+  {
+    return rv;
+  }
+  std::lock_guard<std::mutex> l(lock_);
+  rv = FindTraceInternal(fileGuid, traceIdx);
   if (rv)
   {
     return rv;
   }
+  auto missed = misses_.find(fileGuid);
+  if (missed != misses_.end() && missed->second.count(traceIdx) != 0)
+  {
+    return nullptr;
+  }
   InvokeProvider(fileGuid);
-  return FindTraceInternal(fileGuid, traceIdx);
+  rv = FindTraceInternal(fileGuid, traceIdx);
+  if (!rv)
+  {
+    misses_[fileGuid].insert(traceIdx);
+    if (!FindSourceFile(fileGuid))
+    {
+      SetUnknownFile(fileGuid, true);
+    }
+  }
+  return rv;
 }
 
 void FormatDatabase::Impl::InvokeProvider(const GUID &fileGuid) const
@@ -159,46 +355,81 @@ void FormatDatabase::Impl::InvokeProvider(const GUID &fileGuid) const
     it->second(
       [this](const GUID &fileGuid, const wchar_t *fileName, TraceFormat &&traceFormat)
       {
-        if(AddSourceFileTrace(fileGuid, std::move(traceFormat)))
-        {
-          SetSourceFilePath(fileGuid, fileName);
-        }
+        AddSourceFileTrace(fileGuid, fileName, std::move(traceFormat));
       });
+    PublishSourceFiles();
   }
 }
 
 const TraceFormat *FormatDatabase::Impl::FindTraceInternal(const GUID &fileGuid, DWORD traceIdx) const
 {
-  auto sit = sourceFiles_.find(fileGuid);
-  if(sit == sourceFiles_.end())
+  auto sourceFile = FindSourceFile(fileGuid);
+  if(!sourceFile)
   {
     return nullptr;
   }
-  auto it = sit->second->traceEvents.find(traceIdx);
-  if(it == sit->second->traceEvents.end())
+  auto index = sourceFile->published.load(std::memory_order_acquire);
+  if(!index || traceIdx >= index->size())
   {
     return nullptr;
   }
-  return it->second.get();
+  return (*index)[traceIdx];
 }
 
-fs::path FormatDatabase::Impl::GetSourceFile(const GUID &fileGuid) const
+const SourceFile *FormatDatabase::Impl::FindSourceFile(const GUID &fileGuid) const
+{
+  auto &last = g_lastSourceFile;
+  if(last.database == id_ && memcmp(&last.fileGuid, &fileGuid, sizeof(GUID)) == 0)
+  {
+    return last.sourceFile;
+  }
+  // source files live as long as the database and ids are never reused, so
+  // a cached entry stays valid
+  auto entry = sourceFiles_.Find(fileGuid);
+  if(!entry)
+  {
+    return nullptr;
+  }
+  last = LastSourceFile {id_, fileGuid, *entry};
+  return *entry;
+}
+
+// A file another file's provider has since added is known, whatever the flag
+bool FormatDatabase::Impl::IsUnknownFile(const GUID &fileGuid) const
+{
+  auto unknown = unknownFiles_.Find(fileGuid);
+  return unknown && (*unknown)->load(std::memory_order_acquire) && !FindSourceFile(fileGuid);
+}
+
+// Called with lock_ held
+void FormatDatabase::Impl::SetUnknownFile(const GUID &fileGuid, bool unknown) const
 {
-  auto sit = sourceFiles_.find(fileGuid);
-  if(sit == sourceFiles_.end())
+  if(auto found = unknownFiles_.Find(fileGuid))
   {
-    return fs::path();
+    (*found)->store(unknown, std::memory_order_release);
   }
-  return sit->second->filePath;
+  else if(unknown)
+  {
+    unknownFlags_.emplace_back(true);
+    unknownFiles_.Insert(fileGuid, &unknownFlags_.back());
+  }
+}
+
+fs::path FormatDatabase::Impl::GetSourceFile(const GUID &fileGuid) const
+{
+  auto sourceFile = FindSourceFile(fileGuid);
+  return sourceFile ? sourceFile->filePath : fs::path();
 }
 
 void FormatDatabase::Impl::AddTraceGuid(const GUID &traceGuid, const wchar_t *traceName)
 {
+  std::lock_guard<std::mutex> l(lock_);
   traces_[traceGuid] = traceName ? traceName : L"";
 }
 
 std::vector<GUID> FormatDatabase::Impl::GetTraceProviderGuids() const
 {
+  std::lock_guard<std::mutex> l(lock_);
   std::vector<GUID> rv;
   for (auto &&kv : traces_)
   {
@@ -263,136 +494,224 @@ std::vector<GUID> FormatDatabase::GetTraceProviderGuids() const
 
 ///////////////////////////////////////////
 
-enum class DataState
+// A filter together with what is known about it: which rows it has been run
+// on and which of those it rejected. Either the callback or the compiled
+// query is set.
+struct FilterEntry
 {
-  NoData,
-  NoProvider,
-  HasData
+  TraceView::FilterId id;
+  TraceView::Filter filter;
+  std::shared_ptr<const TraceQuery> query;
+  RowBitmap evaluated;
+  RowBitmap rejected;
 };
 
-struct TraceEventItem
+// What readers see: the visible events and the store as they were at the
+// last delivered change. Readers use it without taking traceLock_.
+struct PublishedView
 {
-  GUID fileGuid;
-  DWORD traceIdx;
-  std::vector<std::uint8_t> paramData;
-  DataState dataState;
-  //
-  std::vector<std::wstring> values;
-  //
-  void *metadata_;
-  //
-  std::wstring &operator[](TraceEventDataItem item)
-  {
-    return values.at(static_cast<size_t>(item));
-  }
-  const std::wstring &operator[](TraceEventDataItem item) const
-  {
-    return values.at(static_cast<size_t>(item));
-  }
-  //
-  TraceEventItem(const GUID &guid, const FILETIME &ts, DWORD trid, DWORD pid, DWORD tid, DWORD order, PVOID d, ULONG dl)
-    : fileGuid(guid)
-    , traceIdx(trid)
-    , paramData(reinterpret_cast<std::uint8_t *>(d), reinterpret_cast<std::uint8_t *>(d) + dl)
-    , dataState(DataState::NoData)
-    , metadata_(nullptr)
-  {
-    values.resize(static_cast<size_t>(TraceEventDataItem::MAX_ITEM));
-    (*this)[TraceEventDataItem::TimeStamp] = FormatFileTime(TIME_FORMAT, ts);
-    (*this)[TraceEventDataItem::ProcessId] = std::to_wstring(pid);
-    (*this)[TraceEventDataItem::ThreadId] = std::to_wstring(tid);
-    (*this)[TraceEventDataItem::TraceIndex] = std::to_wstring(order);
-  }
-  TraceEventItem(const std::vector<std::wstring> &items)
-    : traceIdx(0)
-    , dataState(DataState::HasData)
-    , metadata_(nullptr)
-    , values(items)
+  StoreView store;
+  SequenceView rows;
+};
+
+namespace
+{
+
+// The snapshot the last GetItemValue() of a thread read from. The events of
+// the value it returned stay readable until the thread asks for the next one,
+// even if the views drop them meanwhile.
+thread_local std::shared_ptr<const PublishedView> ValueSnapshot;
+
+// Numbers and time stamps are formatted into a small ring of per thread
+// strings. The other values live in the chunk or the format database and
+// need the row decoded.
+bool IsScratchValue(TraceEventDataItem item)
+{
+  switch(item)
   {
+  case TraceEventDataItem::TraceIndex:
+  case TraceEventDataItem::TimeStamp:
+  case TraceEventDataItem::ProcessId:
+  case TraceEventDataItem::ThreadId:
+    return true;
+  default:
+    break;
   }
-  TraceEventItem()
-    : traceIdx(0)
-    , dataState(DataState::HasData)
-    , metadata_(nullptr)
-    , values(static_cast<size_t>(TraceEventDataItem::MAX_ITEM))
+  return false;
+}
+
+// Filter callbacks are user code that need not be thread safe, so only
+// expression filters are spread over the worker pool
+void FilterFor(bool parallel, size_t count, const std::function<void (size_t index)> &body)
+{
+  if(parallel)
   {
+    ParallelFor(count, body);
+    return;
   }
-  bool EvaluateItem(const FormatDatabase &db)
+  for(size_t i = 0; i < count; ++i)
   {
-    if(dataState == DataState::HasData)
-    {
-      return true;
-    }
-    if(dataState == DataState::NoProvider)
-    {
-      return false;
-    }
-    auto traceFmt = db.FindTrace(fileGuid, traceIdx);
-    if(!traceFmt)
-    {
-      dataState = DataState::NoProvider;
-      return false;
-    }
-    TraceFormatData fmtData {&paramData[0], paramData.size()};
-    (*this)[TraceEventDataItem::Function] = traceFmt->function;
-    (*this)[TraceEventDataItem::ModuleName] = traceFmt->moduleName;
-    (*this)[TraceEventDataItem::LineNumber] = std::to_wstring(traceFmt->lineNumber);
-    (*this)[TraceEventDataItem::SourceFile] = db.GetSourceFile(fileGuid).filename();
-    (*this)[TraceEventDataItem::Message] = FormatTraceFormat(*traceFmt, fmtData);
-    (*this).dataState = DataState::HasData;
-    return true;
+    body(i);
   }
+}
+
+} // private namespace
+
+// Cells of a block of rows, row by row. Scratch values are copied into
+// strings kept for reuse, the others point into the chunks held here.
+class ItemValues::Impl
+{
+public:
+  Impl();
+  void Reset(size_t count, size_t columns);
+  void Hold(const std::shared_ptr<EventChunk> &chunk);
+  void Add(const std::wstring &value, bool copy);
+  size_t Count() const;
+  const wchar_t *Value(size_t index, size_t column, size_t *valueLength) const;
+private:
+  std::vector<std::shared_ptr<EventChunk>> chunks_;
+  std::vector<std::wstring> copies_;
+  std::vector<std::pair<const wchar_t *, size_t>> cells_;
+  size_t copied_;
+  size_t count_;
+  size_t columns_;
+};
+
+// The events one view shows. Its sequence and bitmaps are changed with the
+// owner's traceLock_ held, its filters are guarded by filterLock_ on top, so
+// ingest can run them without the owner's lock.
+class TraceView::Impl
+{
+  friend class TraceView;
+  friend class TraceEnumerator::Impl;
+  using FilterList = std::list<FilterEntry>;
+  using FilterResults = std::vector<std::pair<FilterId, bool>>;
+public:
+  Impl(TraceEnumerator::Impl *owner, ViewOrder order);
+  void SetCountCallback(const CountCallback &countCallback);
+  void SetCountUpdateCallback(const CountUpdateCallback &countUpdateCallback);
+  void SetNotifyPolicy(const NotifyPolicy &policy);
+  size_t GetItemCount() const;
+  size_t FindIndexAtTime(std::uint64_t timeStamp) const;
+  std::pair<size_t, size_t> GetTimeRange(std::uint64_t begin, std::uint64_t end) const;
+  const wchar_t *GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const;
+  const std::wstring &GetItemValue(size_t index, TraceEventDataItem item) const;
+  size_t GetItemValues(size_t first, size_t count, const std::vector<TraceEventDataItem> &items, ItemValues::Impl &values) const;
+  void *GetItemMetadata(size_t index);
+  bool SetItemMetadata(size_t index, void *metadata);
+  FilterId AddFilter(const Filter &filter, const std::shared_ptr<const TraceQuery> &query);
+  bool RemoveFilter(FilterId id);
+  void RemoveAllFilters();
+  void ApplyFilters();
+  std::vector<size_t> FindText(const std::wstring &text, bool wholeWord) const;
+  void Close();
+private:
+  void Rebuild();
+  FilterResults RunFilters(const EventRef &ev) const;
+  void Insert(const EventRef &ev, const FilterResults *results);
+  void RemoveBefore(EventRow first, EventRow end);
+  void Clear();
+  bool RunFilter(const FilterEntry &entry, const EventRef &ev) const;
+  bool EvaluateFilter(FilterEntry &entry, const EventRef &ev);
+  void NarrowVisible(FilterEntry &entry);
+  void RecombineFilters();
+  void RebuildRows();
+  void NotifyCount();
+  void DeliverCount();
+  void Publish();
+  std::shared_ptr<const PublishedView> Published() const;
+private:
+  TraceEnumerator::Impl *owner_;
+  CountCallback countCallback_;
+  CountUpdateCallback countUpdateCallback_;
+  EventSequence rows_;
+  FilterList filters_;
+  FilterId nextFilterId_;
+  RowBitmap visible_;
+  mutable std::mutex filterLock_;
+  std::shared_ptr<const PublishedView> published_;
+  CountNotifier notifier_;
 };
 
 class TraceEnumerator::Impl : public Observer
 {
   friend class TraceEnumerator;
-  using FilterList = std::list<std::function<bool(TraceEventDataItem item, const std::wstring &value)>>;
+  friend class TraceView::Impl;
 public:
   TraceEnumerator::Impl::Impl(const FormatDatabase *db);
   TraceEnumerator::Impl::~Impl();
   void SetStartTime(const FILETIME &startTime);
   void SetStartTime(const LARGE_INTEGER &startTime);
-  size_t GetItemCount() const;
-  const wchar_t *GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const;
-  const std::wstring &GetItemValue(size_t index, TraceEventDataItem item) const;
   void InjectItem(const FILETIME &timeStamp, const std::function<std::wstring(TraceEventDataItem item)> &itemValue);
-  void *GetItemMetadata(size_t index);
-  bool SetItemMetadata(size_t index, void *metadata);
-  void ApplyFilters();
   template <class MofType>
   static void CALLBACK EventCallback(PEVENT_TRACE pEvent);
-  void InsertItem(std::unique_ptr<TraceEventItem> item);
+  void InsertItem(EventRow row);
+  void InsertItem(std::uint64_t timeStamp, EventText &&text);
   std::vector<GUID> GetTraceGuids() const;
   void SetProvidersUpdatedCallback(const std::function<void ()> &pup);
+  void SetDecodeMode(DecodeMode mode);
+  void SetRetentionPolicy(const RetentionPolicy &policy);
+  void SetSpillPolicy(const SpillPolicy &policy);
+  void FlushNotifications();
+  void EnableTextIndex(bool enable);
   void ClearAllTraces();
+  std::shared_ptr<TraceView::Impl> CreateView(ViewOrder order);
+  void RemoveView(const TraceView::Impl *view);
   //
   void Notify(const Observable *o) override;
 private:
-  bool GenerateLogEntry(const GUID &fileGuid, DWORD traceId, const FILETIME &timeStamp, DWORD processId, DWORD threadId, PVOID params, size_t paramLen);
-  bool TestFilters(TraceEventItem &tei);
-  bool EvaluateItem(TraceEventItem &tei) const;
-  std::pair<FilterList::const_iterator, FilterList::const_iterator> GetFilterRange() const;
-  template <class PtrT>
-  size_t FindInsertPosition(const std::vector<PtrT> &v, const std::wstring &timeStamp) const;
-  template <class PtrT>
-  size_t FindInitialInsertPosition(const std::vector<PtrT> &v, const std::wstring &timeStamp) const;
+  bool GenerateLogEntry(const EventRef &ev);
+  bool OverRetention() const;
+  void ApplyRetention();
+  void ApplySpill();
+  void IndexItem(const EventRef &ev);
+  bool EvaluateItem(const EventRef &ev) const;
 private:
   const FormatDatabase *db_;
   LogCallback logger_;
-  CountCallback countCallback_;
+  DecodeMode decodeMode_;
+  RetentionPolicy retention_;
+  SpillPolicy spill_;
   FILETIME startTime_;
-  std::vector<std::unique_ptr<TraceEventItem>> allTraces_;
-  std::vector<TraceEventItem *> filteredTraceEvents_;
+  TraceEventStore store_;
+  EventSequence allTraces_;
+  std::vector<EventRow> appended_;
+  std::vector<std::shared_ptr<TraceView::Impl>> views_;
   mutable std::mutex traceLock_;
-  FilterList filters_;
-  mutable std::mutex filterLock_;
+  std::atomic<bool> textIndexEnabled_;
+  TextIndex textIndex_;
   std::function<void ()> providersUpdated_;
-  int uniqueCounter_;
 };
 
+RetentionPolicy::RetentionPolicy()
+  : maxEvents(0)
+  , maxBytes(0)
+  , maxAgeSeconds(0)
+{
+}
+
+SpillPolicy::SpillPolicy()
+  : maxResidentBytes(0)
+{
+}
+
+CountUpdate::CountUpdate()
+  : count(0)
+  , reset(false)
+{
+}
+
+NotifyPolicy::NotifyPolicy()
+  : intervalMilliseconds(0)
+  , eventThreshold(0)
+{
+}
+
 TraceEnumerator::Impl::Impl(const FormatDatabase *db)
   : db_(db)
+  , decodeMode_(DecodeMode::Immediate)
+  , store_(*db)
+  , textIndexEnabled_(false)
 {
   db_->AddObserver(this);
 }
@@ -412,17 +731,16 @@ void TraceEnumerator::Impl::SetProvidersUpdatedCallback(const std::function<void
   providersUpdated_ = pup;
 }
 
+void TraceEnumerator::Impl::SetDecodeMode(DecodeMode mode)
+{
+  decodeMode_ = mode;
+}
+
 void TraceEnumerator::Impl::Notify(const Observable *o)
 {
   {
     std::lock_guard<std::mutex> l(traceLock_);
-    for (auto &&te : allTraces_)
-    {
-      if (te->dataState == DataState::NoProvider)
-      {
-        te->dataState = DataState::NoData;
-      }
-    }
+    store_.ResetUnresolved();
   }
   if(providersUpdated_)
   {
@@ -432,15 +750,30 @@ void TraceEnumerator::Impl::Notify(const Observable *o)
 
 void TraceEnumerator::Impl::ClearAllTraces()
 {
-  std::lock_guard<std::mutex> l(traceLock_);
-  filteredTraceEvents_.clear();
-  allTraces_.clear();
+  std::vector<std::shared_ptr<TraceView::Impl>> views;
+  {
+    std::lock_guard<std::mutex> l(traceLock_);
+    allTraces_.Clear();
+    appended_.clear();
+    textIndex_.Clear();
+    store_.Clear();
+    for(auto &&view : views_)
+    {
+      view->Clear();
+    }
+    views = views_;
+  }
+  for(auto &&view : views)
+  {
+    view->notifier_.Post();
+  }
 }
 
 thread_local TraceEnumerator::Impl *g_thread_enum = nullptr;
 
 TraceEnumerator::TraceEnumerator(const FormatDatabase &db)
   : impl_(std::make_unique<Impl>(&db))
+  , view_(CreateView())
 {
 }
 
@@ -448,6 +781,17 @@ TraceEnumerator::~TraceEnumerator()
 {
 }
 
+// The view starts out with every stored event and no filters
+std::unique_ptr<TraceView> TraceEnumerator::CreateView(ViewOrder order)
+{
+  return std::unique_ptr<TraceView>(new TraceView(impl_->CreateView(order)));
+}
+
+TraceView &TraceEnumerator::GetDefaultView()
+{
+  return *view_;
+}
+
 void TraceEnumerator::SetLogFunction(const LogCallback &logger)
 {
   impl_->logger_ = logger;
@@ -455,50 +799,102 @@ void TraceEnumerator::SetLogFunction(const LogCallback &logger)
 
 void TraceEnumerator::SetCountCallback(const CountCallback &countCallback)
 {
-  impl_->countCallback_ = countCallback;
+  view_->SetCountCallback(countCallback);
 }
 
-void TraceEnumerator::AddFilter(const std::function<bool (TraceEventDataItem item, const std::wstring &txt)> &filter)
+void TraceEnumerator::SetCountUpdateCallback(const CountUpdateCallback &countUpdateCallback)
 {
-  {
-    std::lock_guard<std::mutex> l(impl_->filterLock_);
-    impl_->filters_.push_back(filter);
-  }
-  impl_->ApplyFilters();
+  view_->SetCountUpdateCallback(countUpdateCallback);
+}
+
+void TraceEnumerator::SetNotifyPolicy(const NotifyPolicy &policy)
+{
+  view_->SetNotifyPolicy(policy);
+}
+
+void TraceEnumerator::SetDecodeMode(DecodeMode mode)
+{
+  impl_->SetDecodeMode(mode);
+}
+
+void TraceEnumerator::SetRetentionPolicy(const RetentionPolicy &policy)
+{
+  impl_->SetRetentionPolicy(policy);
+}
+
+void TraceEnumerator::SetSpillPolicy(const SpillPolicy &policy)
+{
+  impl_->SetSpillPolicy(policy);
+}
+
+void TraceEnumerator::EnableTextIndex(bool enable)
+{
+  impl_->EnableTextIndex(enable);
+}
+
+std::vector<size_t> TraceEnumerator::FindText(const std::wstring &text, bool wholeWord) const
+{
+  return view_->FindText(text, wholeWord);
+}
+
+TraceEnumerator::FilterId TraceEnumerator::AddFilter(const Filter &filter)
+{
+  return view_->AddFilter(filter);
+}
+
+TraceEnumerator::FilterId TraceEnumerator::AddFilterExpression(const std::wstring &expression, std::wstring *error)
+{
+  return view_->AddFilterExpression(expression, error);
+}
+
+bool TraceEnumerator::RemoveFilter(FilterId id)
+{
+  return view_->RemoveFilter(id);
 }
 
 void TraceEnumerator::RemoveAllFilters()
 {
-  {
-    std::lock_guard<std::mutex> l(impl_->filterLock_);
-    impl_->filters_.clear();
-  }
-  impl_->ApplyFilters();
+  view_->RemoveAllFilters();
 }
 
 size_t TraceEnumerator::GetItemCount() const
 {
-  return impl_->GetItemCount();
+  return view_->GetItemCount();
+}
+
+size_t TraceEnumerator::FindIndexAtTime(const FILETIME &timeStamp) const
+{
+  return view_->FindIndexAtTime(timeStamp);
+}
+
+std::pair<size_t, size_t> TraceEnumerator::GetTimeRange(const FILETIME &begin, const FILETIME &end) const
+{
+  return view_->GetTimeRange(begin, end);
 }
 
 const wchar_t *TraceEnumerator::GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const
 {
-  return impl_->GetItemValue(index, item, valueLength);
+  return view_->GetItemValue(index, item, valueLength);
 }
 
 const std::wstring &TraceEnumerator::GetItemValue(size_t index, TraceEventDataItem item) const
 {
-  return impl_->GetItemValue(index, item);
+  return view_->GetItemValue(index, item);
+}
+
+size_t TraceEnumerator::GetItemValues(size_t first, size_t count, const std::vector<TraceEventDataItem> &items, ItemValues &values) const
+{
+  return view_->GetItemValues(first, count, items, values);
 }
 
 void *TraceEnumerator::GetItemMetadata(size_t index)
 {
-  return impl_->GetItemMetadata(index);
+  return view_->GetItemMetadata(index);
 }
 
 bool TraceEnumerator::SetItemMetadata(size_t index, void *metadata)
 {
-  return impl_->SetItemMetadata(index, metadata);
+  return view_->SetItemMetadata(index, metadata);
 }
 
 void TraceEnumerator::InjectItem(const FILETIME &timeStamp, const std::function<std::wstring(TraceEventDataItem item)> &itemValue)
@@ -508,7 +904,7 @@ void TraceEnumerator::InjectItem(const FILETIME &timeStamp, const std::function<
 
 void TraceEnumerator::ApplyFilters()
 {
-  impl_->ApplyFilters();
+  view_->ApplyFilters();
 }
 
 void TraceEnumerator::RemoveAllItems()
@@ -518,60 +914,246 @@ void TraceEnumerator::RemoveAllItems()
 
 ////////////////////
 
-bool TraceEnumerator::Impl::GenerateLogEntry(const GUID &fileGuid, DWORD traceId, const FILETIME &timeStamp, DWORD processId, DWORD threadId, PVOID params, size_t paramLen)
+ItemValues::ItemValues()
+  : impl_(std::make_unique<Impl>())
+{
+}
+
+ItemValues::~ItemValues()
+{
+}
+
+size_t ItemValues::GetCount() const
+{
+  return impl_->Count();
+}
+
+const wchar_t *ItemValues::GetValue(size_t index, size_t column, size_t *valueLength) const
+{
+  return impl_->Value(index, column, valueLength);
+}
+
+ItemValues::Impl::Impl()
+  : copied_(0)
+  , count_(0)
+  , columns_(0)
 {
-  auto traceFmt = db_->FindTrace(fileGuid, traceId);
-  if(!traceFmt)
+}
+
+void ItemValues::Impl::Reset(size_t count, size_t columns)
+{
+  chunks_.clear();
+  cells_.clear();
+  cells_.reserve(count * columns);
+  // sized before the first value is copied, so no string moves once a cell
+  // points to it
+  if(copies_.size() < count * columns)
   {
-    return false;
+    copies_.resize(count * columns);
   }
-  TraceFormatData fmtData {params, paramLen};
-  TraceEventData evt;
-  evt.function = traceFmt->function;
-  evt.moduleName = traceFmt->moduleName;
-  evt.lineNumber = traceFmt->lineNumber;
-  evt.sourceFile = db_->GetSourceFile(fileGuid);
-  evt.processId = processId;
-  evt.threadId = threadId;
-  evt.timeStamp = startTime_ + timeStamp;
-  evt.message = FormatTraceFormat(*traceFmt, fmtData);
-  logger_(evt);
-  return true;
+  copied_ = 0;
+  count_ = count;
+  columns_ = columns;
 }
 
-bool TraceEnumerator::Impl::TestFilters(TraceEventItem &tei)
+void ItemValues::Impl::Hold(const std::shared_ptr<EventChunk> &chunk)
 {
-  auto filterRange = GetFilterRange();
-  tei.EvaluateItem(*db_);
-  for(auto it = filterRange.first; it != filterRange.second; ++it)
+  if(chunks_.empty() || chunks_.back() != chunk)
   {
-    for(auto v = TraceEventDataItem::TraceIndex; v < TraceEventDataItem::MAX_ITEM; ++v)
-    {
-      if(!(*it)(v, tei[v]))
-      {
-        return false;
-      }
-    }
+    chunks_.push_back(chunk);
   }
-  return true;
 }
 
-void TraceEnumerator::Impl::ApplyFilters()
+void ItemValues::Impl::Add(const std::wstring &value, bool copy)
 {
+  if(copy)
   {
-    std::lock_guard<std::mutex> l(traceLock_);
-    filteredTraceEvents_.clear();
-    for (auto &&te : allTraces_)
-    {
-      if (TestFilters(*te))
-      {
-        filteredTraceEvents_.push_back(te.get());
-      }
+    auto &s = copies_[copied_++];
+    s.assign(value);
+    cells_.emplace_back(s.c_str(), s.length());
+    return;
+  }
+  cells_.emplace_back(value.c_str(), value.length());
+}
+
+size_t ItemValues::Impl::Count() const
+{
+  return count_;
+}
+
+const wchar_t *ItemValues::Impl::Value(size_t index, size_t column, size_t *valueLength) const
+{
+  if(index >= count_ || column >= columns_)
+  {
+    return nullptr;
+  }
+  auto &cell = cells_[index * columns_ + column];
+  if(valueLength)
+  {
+    *valueLength = cell.second;
+  }
+  return cell.first;
+}
+
+////////////////////
+
+TraceView::TraceView(const std::shared_ptr<Impl> &impl)
+  : impl_(impl)
+{
+}
+
+TraceView::~TraceView()
+{
+  impl_->Close();
+}
+
+void TraceView::SetCountCallback(const CountCallback &countCallback)
+{
+  impl_->SetCountCallback(countCallback);
+}
+
+void TraceView::SetCountUpdateCallback(const CountUpdateCallback &countUpdateCallback)
+{
+  impl_->SetCountUpdateCallback(countUpdateCallback);
+}
+
+void TraceView::SetNotifyPolicy(const NotifyPolicy &policy)
+{
+  impl_->SetNotifyPolicy(policy);
+}
+
+std::vector<size_t> TraceView::FindText(const std::wstring &text, bool wholeWord) const
+{
+  return impl_->FindText(text, wholeWord);
+}
+
+TraceView::FilterId TraceView::AddFilter(const Filter &filter)
+{
+  return impl_->AddFilter(filter, nullptr);
+}
+
+TraceView::FilterId TraceView::AddFilterExpression(const std::wstring &expression, std::wstring *error)
+{
+  auto query = std::make_shared<TraceQuery>();
+  if(!query->Compile(expression, error))
+  {
+    return InvalidFilter;
+  }
+  return impl_->AddFilter(nullptr, query);
+}
+
+bool TraceView::RemoveFilter(FilterId id)
+{
+  return impl_->RemoveFilter(id);
+}
+
+void TraceView::RemoveAllFilters()
+{
+  impl_->RemoveAllFilters();
+}
+
+void TraceView::ApplyFilters()
+{
+  impl_->ApplyFilters();
+}
+
+size_t TraceView::GetItemCount() const
+{
+  return impl_->GetItemCount();
+}
+
+size_t TraceView::FindIndexAtTime(const FILETIME &timeStamp) const
+{
+  return impl_->FindIndexAtTime(FileTimeToTicks(timeStamp));
+}
+
+std::pair<size_t, size_t> TraceView::GetTimeRange(const FILETIME &begin, const FILETIME &end) const
+{
+  return impl_->GetTimeRange(FileTimeToTicks(begin), FileTimeToTicks(end));
+}
+
+const wchar_t *TraceView::GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const
+{
+  return impl_->GetItemValue(index, item, valueLength);
+}
+
+const std::wstring &TraceView::GetItemValue(size_t index, TraceEventDataItem item) const
+{
+  return impl_->GetItemValue(index, item);
+}
+
+// Reads up to count events from first on, for each the given items. Returns
+// the number of events read.
+size_t TraceView::GetItemValues(size_t first, size_t count, const std::vector<TraceEventDataItem> &items, ItemValues &values) const
+{
+  return impl_->GetItemValues(first, count, items, *values.impl_);
+}
+
+void *TraceView::GetItemMetadata(size_t index)
+{
+  return impl_->GetItemMetadata(index);
+}
+
+bool TraceView::SetItemMetadata(size_t index, void *metadata)
+{
+  return impl_->SetItemMetadata(index, metadata);
+}
+
+////////////////////
+
+bool TraceEnumerator::Impl::GenerateLogEntry(const EventRef &ev)
+{
+  const auto &chunk = *ev.chunk;
+  if(!chunk.HasData(ev.offset) || !chunk.formats[ev.offset])
+  {
+    return false;
+  }
+  auto traceFmt = chunk.formats[ev.offset];
+  TraceEventData evt;
+  evt.function = *traceFmt->site.function;
+  evt.moduleName = *traceFmt->site.moduleName;
+  evt.lineNumber = traceFmt->lineNumber;
+  evt.sourceFile = *traceFmt->site.sourcePath;
+  evt.processId = chunk.processIds[ev.offset];
+  evt.threadId = chunk.threadIds[ev.offset];
+  evt.timeStamp = TicksToFileTime(chunk.timeStamps[ev.offset]);
+  evt.message = chunk.messages[ev.offset];
+  logger_(evt);
+  return true;
+}
+
+std::shared_ptr<TraceView::Impl> TraceEnumerator::Impl::CreateView(ViewOrder order)
+{
+  auto view = std::make_shared<TraceView::Impl>(this, order);
+  std::lock_guard<std::mutex> l(traceLock_);
+  view->Rebuild();
+  views_.push_back(view);
+  return view;
+}
+
+void TraceEnumerator::Impl::RemoveView(const TraceView::Impl *view)
+{
+  std::lock_guard<std::mutex> l(traceLock_);
+  views_.erase(std::remove_if(views_.begin(), views_.end(), [view](const std::shared_ptr<TraceView::Impl> &v) { return v.get() == view; }), views_.end());
+}
+
+// Delivers pending count changes of every view. Once a file has been read
+// its events are readable on return, the notifications follow from the
+// notifier threads.
+void TraceEnumerator::Impl::FlushNotifications()
+{
+  std::vector<std::shared_ptr<TraceView::Impl>> views;
+  {
+    std::lock_guard<std::mutex> l(traceLock_);
+    for(auto &&view : views_)
+    {
+      view->Publish();
     }
+    views = views_;
   }
-  if(countCallback_)
+  for(auto &&view : views)
   {
-    countCallback_(filteredTraceEvents_.size());
+    view->notifier_.Flush();
   }
 }
 
@@ -598,62 +1180,235 @@ void CALLBACK TraceEnumerator::Impl::EventCallback(PEVENT_TRACE pEvent)
   }
   auto mofData = reinterpret_cast<MofType *>(reinterpret_cast<char *>(pEvent->MofData) + offset);
   DWORD traceId = LOWORD(pEvent->Header.Version);
-  auto tei = std::make_unique<TraceEventItem>(mofData->sourceFileGUID, context->startTime_ + mofData->GetTimeStamp(), traceId, mofData->processId, mofData->threadId, static_cast<DWORD>(context->allTraces_.size()), &mofData->params, pEvent->MofLength);
-  context->EvaluateItem(*tei);
-  context->InsertItem(std::move(tei));
+  const auto timeStamp = context->startTime_ + mofData->GetTimeStamp();
+  EventRef ev;
+  {
+    std::lock_guard<std::mutex> l(context->traceLock_);
+    auto row = context->store_.Append(mofData->sourceFileGUID, traceId, FileTimeToTicks(timeStamp), mofData->processId, mofData->threadId, &mofData->params, pEvent->MofLength);
+    context->appended_.push_back(row);
+    ev = context->store_.At(row);
+  }
+  // the logger consumes the decoded fields right away, deferred mode waits for a reader
+  if (context->decodeMode_ == DecodeMode::Immediate || context->logger_)
+  {
+    context->EvaluateItem(ev);
+  }
   if (context->logger_)
   {
-    context->GenerateLogEntry(mofData->sourceFileGUID, traceId, context->startTime_ + mofData->timeStamp, mofData->processId, mofData->threadId, &mofData->params, pEvent->MofLength);
+    context->GenerateLogEntry(ev);
   }
+  context->InsertItem(ev.row);
 }
 
-template <class U, class T>
-void InsertOrAppend(std::vector<U> &v, size_t index, T &&value)
+// The row is decoded once and then filtered by every view. Until it is
+// inserted it is listed in appended_, so views rebuilt meanwhile leave it out.
+void TraceEnumerator::Impl::InsertItem(EventRow row)
 {
-  if (index >= v.size())
+  EventRef ev;
+  std::vector<std::shared_ptr<TraceView::Impl>> views;
+  {
+    std::lock_guard<std::mutex> l(traceLock_);
+    auto it = std::find(appended_.begin(), appended_.end(), row);
+    if(it == appended_.end())
+    {
+      return;
+    }
+    if(row < store_.FirstRow())
+    {
+      appended_.erase(it);
+      return;
+    }
+    ev = store_.At(row);
+    views = views_;
+  }
+  if(textIndexEnabled_)
   {
-    v.push_back(std::forward<T>(value));
+    IndexItem(ev);
   }
-  else
+  // run the filters without blocking readers, a view or filter added in the
+  // meantime is caught up below
+  std::vector<TraceView::Impl::FilterResults> results;
+  results.reserve(views.size());
+  for(auto &&view : views)
   {
-    v.insert(v.begin() + index, std::forward<T>(value));
+    results.push_back(view->RunFilters(ev));
+  }
+  {
+    std::lock_guard<std::mutex> l(traceLock_);
+    auto it = std::find(appended_.begin(), appended_.end(), row);
+    if(it == appended_.end())
+    {
+      return;
+    }
+    appended_.erase(it);
+    allTraces_.Insert(row, store_);
+    for(auto &&view : views_)
+    {
+      auto it = std::find(views.begin(), views.end(), view);
+      view->Insert(ev, it != views.end() ? &results[it - views.begin()] : nullptr);
+    }
+    ApplyRetention();
+    ApplySpill();
+    views = views_;
+  }
+  for(auto &&view : views)
+  {
+    view->notifier_.Post();
   }
 }
 
-void TraceEnumerator::Impl::InsertItem(std::unique_ptr<TraceEventItem> item)
+void TraceEnumerator::Impl::InsertItem(std::uint64_t timeStamp, EventText &&text)
 {
-  size_t filteredItemCount = 0;
-  const bool filterMatch = TestFilters(*item);
+  EventRow row;
   {
     std::lock_guard<std::mutex> l(traceLock_);
-    //
-    auto timeStamp = (*item)[TraceEventDataItem::TimeStamp];
-    auto aindex = FindInsertPosition(allTraces_, timeStamp);
-    (*item)[TraceEventDataItem::TraceIndex] = std::to_wstring(uniqueCounter_++);
-    auto rawPtr = item.get(); // gets lost once we move
-    InsertOrAppend(allTraces_, aindex, std::move(item));
-    if (filterMatch)
+    row = store_.Append(timeStamp, std::move(text));
+    appended_.push_back(row);
+  }
+  InsertItem(row);
+}
+
+void TraceEnumerator::Impl::SetRetentionPolicy(const RetentionPolicy &policy)
+{
+  std::vector<std::shared_ptr<TraceView::Impl>> views;
+  {
+    std::lock_guard<std::mutex> l(traceLock_);
+    retention_ = policy;
+    ApplyRetention();
+    views = views_;
+  }
+  for(auto &&view : views)
+  {
+    view->NotifyCount();
+  }
+}
+
+void TraceEnumerator::Impl::SetSpillPolicy(const SpillPolicy &policy)
+{
+  std::lock_guard<std::mutex> l(traceLock_);
+  spill_ = policy;
+  ApplySpill();
+}
+
+bool TraceEnumerator::Impl::OverRetention() const
+{
+  // the chunk being filled is never evicted
+  if(store_.ChunkCount() < 2)
+  {
+    return false;
+  }
+  if(retention_.maxEvents && store_.Count() > retention_.maxEvents)
+  {
+    return true;
+  }
+  if(retention_.maxBytes && store_.Bytes() > retention_.maxBytes)
+  {
+    return true;
+  }
+  if(retention_.maxAgeSeconds && !allTraces_.Empty())
+  {
+    const auto newest = store_.TimeStamp(allTraces_[allTraces_.Size() - 1]);
+    const auto maxAge = static_cast<std::uint64_t>(retention_.maxAgeSeconds) * 10000000ULL;
+    return newest > maxAge && store_.OldestChunkNewest() < newest - maxAge;
+  }
+  return false;
+}
+
+// Evicts the oldest chunks while a limit is exceeded. Their rows are the
+// earliest arrivals, so dropping them from the ordered sequences only scans
+// the first few blocks, and the bitmaps simply release their blocks.
+void TraceEnumerator::Impl::ApplyRetention()
+{
+  while(OverRetention())
+  {
+    const auto first = store_.FirstRow();
+    const auto rows = store_.EvictOldest();
+    const auto end = first + rows;
+    allTraces_.RemoveBefore(end, rows);
+    for(auto &&view : views_)
     {
-      auto findex = FindInsertPosition(filteredTraceEvents_, timeStamp);
-      InsertOrAppend(filteredTraceEvents_, findex, rawPtr);
+      view->RemoveBefore(first, end);
     }
-    filteredItemCount = filteredTraceEvents_.size();
+    textIndex_.RemoveBefore(end);
   }
-  if (countCallback_)
+}
+
+// Spills the oldest chunks while the resident ones are over budget. Only
+// the store changes, rows keep their place in the sequences and bitmaps.
+void TraceEnumerator::Impl::ApplySpill()
+{
+  while(spill_.maxResidentBytes && store_.Bytes() > spill_.maxResidentBytes && store_.SpillOldest(spill_.directory))
   {
-    countCallback_(filteredItemCount);
   }
 }
 
-bool TraceEnumerator::Impl::EvaluateItem(TraceEventItem &ev) const
+// A row without a provider yet is searched without the index until a search
+// finds it decoded
+void TraceEnumerator::Impl::IndexItem(const EventRef &ev)
 {
-  return ev.EvaluateItem(*db_);
+  if(!EvaluateItem(ev))
+  {
+    textIndex_.AddUnresolved(ev.row);
+    return;
+  }
+  textIndex_.Add(ev.row, store_.Value(ev, TraceEventDataItem::Message));
 }
 
-std::pair<TraceEnumerator::Impl::FilterList::const_iterator, TraceEnumerator::Impl::FilterList::const_iterator> TraceEnumerator::Impl::GetFilterRange() const
+// Indexing formats every message, so it is off until a search needs it
+void TraceEnumerator::Impl::EnableTextIndex(bool enable)
 {
-  std::lock_guard<std::mutex> l(filterLock_);
-  return std::make_pair(filters_.cbegin(), filters_.cend());
+  if(!enable)
+  {
+    textIndexEnabled_ = false;
+    textIndex_.Clear();
+    return;
+  }
+  if(textIndexEnabled_.exchange(true))
+  {
+    return;
+  }
+  // rows arriving from now on are indexed by InsertItem, the stored ones are
+  // indexed chunk by chunk and merged in
+  std::vector<std::shared_ptr<EventChunk>> chunks;
+  EventRow firstRow;
+  EventRow rows;
+  {
+    std::lock_guard<std::mutex> l(traceLock_);
+    chunks = store_.Chunks();
+    firstRow = store_.FirstRow();
+    rows = store_.Size();
+  }
+  std::vector<TextIndex::Postings> parts(chunks.size());
+  std::vector<std::vector<EventRow>> unresolved(chunks.size());
+  ParallelFor(chunks.size(), [this, &chunks, &parts, &unresolved, firstRow, rows](size_t c)
+  {
+    const auto first = firstRow + c * EventChunk::Capacity;
+    const auto last = (std::min)(rows, first + EventChunk::Capacity);
+    auto chunk = store_.Load(chunks[c]);
+    for(auto row = first; row < last; ++row)
+    {
+      EventRef ev {chunk, static_cast<size_t>(row - first), row};
+      if(!EvaluateItem(ev))
+      {
+        unresolved[c].push_back(row);
+        continue;
+      }
+      TextIndex::AddTo(parts[c], ev.row, store_.Value(ev, TraceEventDataItem::Message));
+    }
+  });
+  for(size_t c = 0; c < parts.size(); ++c)
+  {
+    textIndex_.Merge(std::move(parts[c]));
+    for(auto row : unresolved[c])
+    {
+      textIndex_.AddUnresolved(row);
+    }
+  }
+}
+
+bool TraceEnumerator::Impl::EvaluateItem(const EventRef &ev) const
+{
+  return store_.Decode(ev);
 }
 
 void TraceEnumerator::Impl::SetStartTime(const FILETIME &startTime)
@@ -667,126 +1422,626 @@ void TraceEnumerator::Impl::SetStartTime(const LARGE_INTEGER &startTime)
   startTime_.dwLowDateTime = startTime.LowPart;
 }
 
-size_t TraceEnumerator::Impl::GetItemCount() const
+void TraceEnumerator::Impl::InjectItem(const FILETIME &timeStamp, const std::function<std::wstring(TraceEventDataItem item)> &itemValue)
+{
+  EventText text;
+  for (TraceEventDataItem item = TraceEventDataItem::ModuleName; item < TraceEventDataItem::MAX_ITEM; ++item)
+  {
+    if (item == TraceEventDataItem::TimeStamp)
+    {
+      continue;
+    }
+    text[static_cast<size_t>(item)] = itemValue(item);
+  }
+  text[static_cast<size_t>(TraceEventDataItem::TimeStamp)] = FormatFileTime(TIME_FORMAT, timeStamp);
+  //
+  InsertItem(FileTimeToTicks(timeStamp), std::move(text));
+}
+
+////////////////////
+
+TraceView::Impl::Impl(TraceEnumerator::Impl *owner, ViewOrder order)
+  : owner_(owner)
+  , rows_(order)
+  , nextFilterId_(1)
+  , notifier_([this]() { DeliverCount(); })
 {
-  std::lock_guard<std::mutex> l(traceLock_);
-  return filteredTraceEvents_.size();
 }
 
-const std::wstring &TraceEnumerator::Impl::GetItemValue(size_t index, TraceEventDataItem item) const
+// Detaches the view from its owner. No callback is made once this returns.
+void TraceView::Impl::Close()
 {
-  static std::wstring EmptyString;
-  TraceEventItem *ev = nullptr;
+  owner_->RemoveView(this);
+  notifier_.Stop();
+  std::lock_guard<std::mutex> l(owner_->traceLock_);
+  countCallback_ = nullptr;
+  countUpdateCallback_ = nullptr;
+}
+
+void TraceView::Impl::SetCountCallback(const CountCallback &countCallback)
+{
+  std::lock_guard<std::mutex> l(owner_->traceLock_);
+  countCallback_ = countCallback;
+}
+
+void TraceView::Impl::SetCountUpdateCallback(const CountUpdateCallback &countUpdateCallback)
+{
+  std::lock_guard<std::mutex> l(owner_->traceLock_);
+  countUpdateCallback_ = countUpdateCallback;
+}
+
+void TraceView::Impl::SetNotifyPolicy(const NotifyPolicy &policy)
+{
+  notifier_.SetPolicy(policy);
+}
+
+// Called with the owner's traceLock_ held
+void TraceView::Impl::Rebuild()
+{
+  std::lock_guard<std::mutex> fl(filterLock_);
+  RecombineFilters();
+  RebuildRows();
+  Publish();
+}
+
+bool TraceView::Impl::RunFilter(const FilterEntry &entry, const EventRef &ev) const
+{
+  auto &store = owner_->store_;
+  if(entry.query)
   {
-    std::lock_guard<std::mutex> l(traceLock_);
-    if (index >= filteredTraceEvents_.size())
+    return entry.query->Matches(store, ev);
+  }
+  owner_->EvaluateItem(ev);
+  for(auto v = TraceEventDataItem::TraceIndex; v < TraceEventDataItem::MAX_ITEM; ++v)
+  {
+    if(!entry.filter(v, store.Value(ev, v)))
     {
-      return EmptyString;
+      return false;
     }
-    ev = filteredTraceEvents_[index];
   }
-  EvaluateItem(*ev);
-  return (*ev)[item];
+  return true;
 }
 
-const wchar_t *TraceEnumerator::Impl::GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const
+bool TraceView::Impl::EvaluateFilter(FilterEntry &entry, const EventRef &ev)
 {
-  TraceEventItem *ev = nullptr;
+  entry.evaluated.Set(ev.row);
+  if(RunFilter(entry, ev))
   {
-    std::lock_guard<std::mutex> l(traceLock_);
-    if (index >= filteredTraceEvents_.size())
+    return true;
+  }
+  entry.rejected.Set(ev.row);
+  return false;
+}
+
+// runs a filter on the rows that are still visible, rows hidden by another
+// filter are left for later
+void TraceView::Impl::NarrowVisible(FilterEntry &entry)
+{
+  auto &store = owner_->store_;
+  RowBitmap pending = visible_;
+  pending.AndNot(entry.evaluated);
+  entry.evaluated.Reserve(store.FirstRow(), store.Size());
+  entry.rejected.Reserve(store.FirstRow(), store.Size());
+  const auto firstBlock = pending.FirstBlock();
+  FilterFor(entry.query != nullptr, pending.EndBlock() - firstBlock, [this, &store, &entry, &pending, firstBlock](size_t block)
+  {
+    EventRef ev;
+    pending.ForEachInBlock(firstBlock + block, [this, &store, &entry, &ev](EventRow row)
     {
-      return nullptr;
+      ev = store.At(row, ev);
+      EvaluateFilter(entry, ev);
+    });
+  });
+  visible_.AndNot(entry.rejected);
+}
+
+void TraceView::Impl::RecombineFilters()
+{
+  auto &store = owner_->store_;
+  visible_.Fill(store.FirstRow(), store.Size());
+  for(auto row : owner_->appended_)
+  {
+    visible_.Reset(row);
+  }
+  for(auto &&entry : filters_)
+  {
+    entry.evaluated.ClearBefore(store.FirstRow());
+    entry.rejected.ClearBefore(store.FirstRow());
+    visible_.AndNot(entry.rejected);
+  }
+  for(auto &&entry : filters_)
+  {
+    NarrowVisible(entry);
+  }
+}
+
+// Time ordered views pick their rows from the owner's time ordered sequence,
+// arrival ordered ones take them from the bitmap, which is in row order
+void TraceView::Impl::RebuildRows()
+{
+  const bool byTime = rows_.Order() == ViewOrder::TimeStamp;
+  const auto blocks = byTime ? owner_->allTraces_.Blocks() : std::vector<const SequenceBlock *>();
+  const auto firstBlock = visible_.FirstBlock();
+  std::vector<std::vector<EventRow>> parts(byTime ? blocks.size() : visible_.EndBlock() - firstBlock);
+  ParallelFor(parts.size(), [this, &blocks, &parts, byTime, firstBlock](size_t block)
+  {
+    if(!byTime)
+    {
+      visible_.ForEachInBlock(firstBlock + block, [&parts, block](EventRow row) { parts[block].push_back(row); });
+      return;
+    }
+    for(auto row : *blocks[block])
+    {
+      if(visible_.Test(row))
+      {
+        parts[block].push_back(row);
+      }
+    }
+  });
+  rows_.Clear();
+  for(auto &&part : parts)
+  {
+    for(auto row : part)
+    {
+      rows_.PushBack(row);
     }
-    ev = filteredTraceEvents_[index];
   }
-  EvaluateItem(*ev);
-  if(valueLength)
+}
+
+// Runs the filters on a new row without the owner's lock
+TraceView::Impl::FilterResults TraceView::Impl::RunFilters(const EventRef &ev) const
+{
+  FilterResults results;
+  std::lock_guard<std::mutex> fl(filterLock_);
+  for(auto &&entry : filters_)
   {
-    *valueLength = (*ev)[item].length();
+    const bool pass = RunFilter(entry, ev);
+    results.emplace_back(entry.id, pass);
+    if(!pass)
+    {
+      break;
+    }
   }
-  return (*ev)[item].c_str();
+  return results;
 }
 
-void *TraceEnumerator::Impl::GetItemMetadata(size_t index)
+// Called with the owner's traceLock_ held. Filters without a result, or all
+// of them without results, are run here.
+void TraceView::Impl::Insert(const EventRef &ev, const FilterResults *results)
 {
-  std::lock_guard<std::mutex> l(traceLock_);
-  if (index >= filteredTraceEvents_.size())
+  std::lock_guard<std::mutex> fl(filterLock_);
+  bool visible = true;
+  for(auto &&entry : filters_)
   {
-    return nullptr;
+    const std::pair<FilterId, bool> *result = nullptr;
+    if(results)
+    {
+      auto it = std::find_if(results->begin(), results->end(), [&entry](const std::pair<FilterId, bool> &r) { return r.first == entry.id; });
+      result = it != results->end() ? &*it : nullptr;
+    }
+    if(result)
+    {
+      entry.evaluated.Set(ev.row);
+      if(!result->second)
+      {
+        entry.rejected.Set(ev.row);
+        visible = false;
+      }
+    }
+    else if(visible)
+    {
+      visible = EvaluateFilter(entry, ev);
+    }
+  }
+  if(visible)
+  {
+    visible_.Set(ev.row);
+    const auto index = rows_.Insert(ev.row, owner_->store_);
+    notifier_.Inserted(index, rows_.Size());
+  }
+  else
+  {
+    visible_.Reset(ev.row);
   }
-  return filteredTraceEvents_[index]->metadata_;
 }
 
-bool TraceEnumerator::Impl::SetItemMetadata(size_t index, void *metadata)
+// Called with the owner's traceLock_ held once the rows in [first, end) are
+// evicted. An eviction shifts every index.
+void TraceView::Impl::RemoveBefore(EventRow first, EventRow end)
 {
-  std::lock_guard<std::mutex> l(traceLock_);
-  if (index >= filteredTraceEvents_.size())
+  const auto visibleRows = visible_.CountInBlock(static_cast<size_t>(first / RowBitmap::BlockRows));
+  rows_.RemoveBefore(end, visibleRows);
+  visible_.ClearBefore(end);
   {
-    return false;
+    std::lock_guard<std::mutex> fl(filterLock_);
+    for(auto &&entry : filters_)
+    {
+      entry.evaluated.ClearBefore(end);
+      entry.rejected.ClearBefore(end);
+    }
+  }
+  notifier_.Reset(rows_.Size());
+}
+
+// Called with the owner's traceLock_ held after the store was cleared
+void TraceView::Impl::Clear()
+{
+  rows_.Clear();
+  visible_.Clear();
+  {
+    std::lock_guard<std::mutex> fl(filterLock_);
+    for(auto &&entry : filters_)
+    {
+      entry.evaluated.Clear();
+      entry.rejected.Clear();
+    }
+  }
+  notifier_.Reset(0);
+  Publish();
+}
+
+// For changes that may touch every visible event, views reload. Readers see
+// the change right away, only the notification may be batched.
+void TraceView::Impl::NotifyCount()
+{
+  {
+    std::lock_guard<std::mutex> l(owner_->traceLock_);
+    notifier_.Reset(rows_.Size());
+    Publish();
+  }
+  notifier_.Post();
+}
+
+// Publishes the events together with the change describing them, so a view
+// reading after the callback sees exactly the announced count
+void TraceView::Impl::DeliverCount()
+{
+  CountUpdate update;
+  CountCallback countCallback;
+  CountUpdateCallback countUpdateCallback;
+  {
+    std::lock_guard<std::mutex> l(owner_->traceLock_);
+    if(!notifier_.Take(update))
+    {
+      return;
+    }
+    Publish();
+    countCallback = countCallback_;
+    countUpdateCallback = countUpdateCallback_;
+  }
+  if(countCallback)
+  {
+    countCallback(update.count);
+  }
+  if(countUpdateCallback)
+  {
+    countUpdateCallback(update);
+  }
+}
+
+// Called with the owner's traceLock_ held. The sequences and the store copy
+// what they change next while the view shares it.
+void TraceView::Impl::Publish()
+{
+  auto view = std::make_shared<PublishedView>();
+  view->store = owner_->store_.View();
+  view->rows = rows_.View();
+  std::atomic_store(&published_, std::shared_ptr<const PublishedView>(std::move(view)));
+}
+
+std::shared_ptr<const PublishedView> TraceView::Impl::Published() const
+{
+  return std::atomic_load(&published_);
+}
+
+TraceView::FilterId TraceView::Impl::AddFilter(const Filter &filter, const std::shared_ptr<const TraceQuery> &query)
+{
+  FilterId id;
+  {
+    std::lock_guard<std::mutex> l(owner_->traceLock_);
+    std::lock_guard<std::mutex> fl(filterLock_);
+    id = nextFilterId_++;
+    filters_.push_back(FilterEntry {id, filter, query});
+    NarrowVisible(filters_.back());
+    RebuildRows();
+  }
+  NotifyCount();
+  return id;
+}
+
+bool TraceView::Impl::RemoveFilter(FilterId id)
+{
+  {
+    std::lock_guard<std::mutex> l(owner_->traceLock_);
+    std::lock_guard<std::mutex> fl(filterLock_);
+    auto it = std::find_if(filters_.begin(), filters_.end(), [id](const FilterEntry &entry) { return entry.id == id; });
+    if(it == filters_.end())
+    {
+      return false;
+    }
+    filters_.erase(it);
+    RecombineFilters();
+    RebuildRows();
   }
-  filteredTraceEvents_[index]->metadata_ = metadata;
+  NotifyCount();
   return true;
 }
 
-template <class PtrT>
-size_t TraceEnumerator::Impl::FindInsertPosition(const std::vector<PtrT> &v, const std::wstring &timeStamp) const
+void TraceView::Impl::RemoveAllFilters()
+{
+  {
+    std::lock_guard<std::mutex> l(owner_->traceLock_);
+    std::lock_guard<std::mutex> fl(filterLock_);
+    filters_.clear();
+    RecombineFilters();
+    RebuildRows();
+  }
+  NotifyCount();
+}
+
+// Forgets every cached filter result and runs all filters again. The rows
+// are filtered chunk by chunk without holding traceLock_, on the worker pool
+// if every filter is an expression. Callbacks are only run with filterLock_
+// held, ingest runs them too, so it waits for a chunk at a time.
+void TraceView::Impl::ApplyFilters()
 {
-  auto cur = FindInitialInsertPosition(v, timeStamp);
-  // 1,2,4,5
-  // 1,2,3,3,3,3,3,4,5,6
-  // we want the *last* position where timestamps are equal
-  while (cur < v.size())
+  auto &store = owner_->store_;
+  std::vector<FilterEntry> fresh;
+  std::vector<std::shared_ptr<EventChunk>> chunks;
+  EventRow firstRow;
+  EventRow rows;
+  size_t generation;
   {
-    if (timeStamp != (*v[cur])[TraceEventDataItem::TimeStamp])
+    std::lock_guard<std::mutex> l(owner_->traceLock_);
+    std::lock_guard<std::mutex> fl(filterLock_);
+    for(auto &&entry : filters_)
     {
-      break;
+      fresh.push_back(FilterEntry {entry.id, entry.filter, entry.query});
     }
-    cur++;
+    chunks = store.Chunks();
+    firstRow = store.FirstRow();
+    rows = store.Size();
+    generation = store.Generation();
   }
-  return cur;
+  const bool parallel = std::all_of(fresh.begin(), fresh.end(), [](const FilterEntry &entry) { return entry.query != nullptr; });
+  for(auto &&entry : fresh)
+  {
+    entry.evaluated.Reserve(firstRow, rows);
+    entry.rejected.Reserve(firstRow, rows);
+  }
+  FilterFor(parallel, fresh.empty() ? 0 : chunks.size(), [this, &store, &fresh, &chunks, firstRow, rows, parallel](size_t c)
+  {
+    const auto first = firstRow + c * EventChunk::Capacity;
+    const auto last = (std::min)(rows, first + EventChunk::Capacity);
+    auto chunk = store.Load(chunks[c]);
+    std::unique_lock<std::mutex> fl(filterLock_, std::defer_lock);
+    if(!parallel)
+    {
+      fl.lock();
+    }
+    for(auto row = first; row < last; ++row)
+    {
+      EventRef ev {chunk, static_cast<size_t>(row - first), row};
+      for(auto &&entry : fresh)
+      {
+        entry.evaluated.Set(ev.row);
+        if(!RunFilter(entry, ev))
+        {
+          entry.rejected.Set(ev.row);
+          break;
+        }
+      }
+    }
+  });
+  {
+    std::lock_guard<std::mutex> l(owner_->traceLock_);
+    std::lock_guard<std::mutex> fl(filterLock_);
+    // the results are of rows that RemoveAllItems dropped meanwhile, their
+    // numbers are in use again
+    if(store.Generation() != generation)
+    {
+      fresh.clear();
+    }
+    for(auto &&entry : filters_)
+    {
+      auto it = std::find_if(fresh.begin(), fresh.end(), [&entry](const FilterEntry &f) { return f.id == entry.id; });
+      if(it != fresh.end())
+      {
+        entry.evaluated = std::move(it->evaluated);
+        entry.rejected = std::move(it->rejected);
+      }
+    }
+    // rows that arrived in the meantime are caught up here
+    RecombineFilters();
+    RebuildRows();
+  }
+  NotifyCount();
 }
 
-template <class PtrT>
-size_t TraceEnumerator::Impl::FindInitialInsertPosition(const std::vector<PtrT> &v, const std::wstring &timeStamp) const
+// Indices of the visible events whose message contains text, ignoring case.
+// With the index enabled only rows holding every trigram of text are read.
+// The indices are those of the published view, as GetItemCount() counts.
+std::vector<size_t> TraceView::Impl::FindText(const std::wstring &text, bool wholeWord) const
 {
-  size_t end = v.size() - 1;
-  size_t start = 0;
-  size_t index = std::numeric_limits<size_t>::max();
-  while (end < v.size() && end >= start)
+  std::vector<size_t> rv;
+  if(text.empty())
+  {
+    return rv;
+  }
+  auto &store = owner_->store_;
+  const auto view = Published();
+  std::wstring needle(text);
+  std::transform(needle.begin(), needle.end(), needle.begin(), towlower);
+  std::vector<EventRow> candidates;
+  std::vector<EventRow> unresolved;
+  const bool indexed = owner_->textIndexEnabled_ && owner_->textIndex_.Candidates(needle, candidates, unresolved);
+  // the view keeps the chunks of its rows readable should retention evict
+  // them during the search, refs from firstUnresolved on are not indexed yet
+  std::vector<EventRef> refs;
+  std::vector<size_t> indices;
+  size_t firstUnresolved = 0;
+  EventRef ev;
+  auto add = [&view, &refs, &indices, &ev](EventRow row, size_t index)
+  {
+    ev = view->store.At(row, ev);
+    refs.push_back(ev);
+    indices.push_back(index);
+  };
+  if(indexed)
+  {
+    auto addVisible = [&view, &add](EventRow row)
+    {
+      if(view->store.Contains(row))
+      {
+        const auto index = view->rows.Find(row, view->store);
+        if(index < view->rows.Size())
+        {
+          add(row, index);
+        }
+      }
+    };
+    std::for_each(candidates.begin(), candidates.end(), addVisible);
+    firstUnresolved = refs.size();
+    std::for_each(unresolved.begin(), unresolved.end(), addVisible);
+  }
+  else
+  {
+    size_t index = 0;
+    view->rows.ForEach([&add, &index](EventRow row)
+    {
+      add(row, index++);
+    });
+  }
+  // a row holding all trigrams may still not contain the text itself
+  const size_t SliceSize = 4096;
+  std::vector<std::uint8_t> match(refs.size());
+  std::vector<std::uint8_t> decoded(refs.size());
+  ParallelFor((refs.size() + SliceSize - 1) / SliceSize, [this, &store, &refs, &match, &decoded, &needle, wholeWord, SliceSize](size_t slice)
   {
-    auto cur = (start + end) / 2;
-    auto cmp = wcscmp(timeStamp.c_str(), (*v[cur])[TraceEventDataItem::TimeStamp].c_str());
-    if (cmp > 0)
+    const auto last = (std::min)(refs.size(), (slice + 1) * SliceSize);
+    for(auto i = slice * SliceSize; i < last; ++i)
     {
-      start = cur + 1;
+      decoded[i] = owner_->EvaluateItem(refs[i]);
+      match[i] = ContainsText(store.Value(refs[i], TraceEventDataItem::Message), needle, wholeWord);
     }
-    else if (cmp < 0)
+  });
+  // rows whose provider was added since they were indexed
+  for(auto i = firstUnresolved; indexed && i < refs.size(); ++i)
+  {
+    if(decoded[i])
     {
-      end = cur - 1;
+      owner_->textIndex_.Resolve(refs[i].row, store.Value(refs[i], TraceEventDataItem::Message));
     }
-    else
+  }
+  for(size_t i = 0; i < refs.size(); ++i)
+  {
+    if(match[i])
     {
-      return cur;
+      rv.push_back(indices[i]);
     }
   }
-  return start;
+  std::sort(rv.begin(), rv.end());
+  return rv;
+}
+
+size_t TraceView::Impl::GetItemCount() const
+{
+  return Published()->rows.Size();
+}
+
+// Index of the first visible event at or after timeStamp, GetItemCount() if
+// every event is earlier
+size_t TraceView::Impl::FindIndexAtTime(std::uint64_t timeStamp) const
+{
+  auto view = Published();
+  return view->rows.LowerBound(timeStamp, view->store);
+}
+
+// The visible events in [begin, end) as a half open index range
+std::pair<size_t, size_t> TraceView::Impl::GetTimeRange(std::uint64_t begin, std::uint64_t end) const
+{
+  auto view = Published();
+  auto first = view->rows.LowerBound(begin, view->store);
+  auto last = end > begin ? view->rows.LowerBound(end, view->store) : first;
+  return std::make_pair(first, last);
+}
+
+const std::wstring &TraceView::Impl::GetItemValue(size_t index, TraceEventDataItem item) const
+{
+  static std::wstring EmptyString;
+  auto view = ValueSnapshot = Published();
+  if (index >= view->rows.Size())
+  {
+    return EmptyString;
+  }
+  auto ev = view->store.At(view->rows[index]);
+  owner_->EvaluateItem(ev);
+  return owner_->store_.DetachedValue(ev, item);
 }
 
-void TraceEnumerator::Impl::InjectItem(const FILETIME &timeStamp, const std::function<std::wstring(TraceEventDataItem item)> &itemValue)
+const wchar_t *TraceView::Impl::GetItemValue(size_t index, TraceEventDataItem item, size_t *valueLength) const
 {
-  auto tei = std::make_unique<TraceEventItem>();
-  for (TraceEventDataItem item = TraceEventDataItem::ModuleName; item < TraceEventDataItem::MAX_ITEM; ++item)
+  auto view = ValueSnapshot = Published();
+  if (index >= view->rows.Size())
   {
-    if (item == TraceEventDataItem::TimeStamp)
+    return nullptr;
+  }
+  auto ev = view->store.At(view->rows[index]);
+  owner_->EvaluateItem(ev);
+  auto &value = owner_->store_.DetachedValue(ev, item);
+  if(valueLength)
+  {
+    *valueLength = value.length();
+  }
+  return value.c_str();
+}
+
+// All rows come from the same snapshot and each is decoded at most once
+size_t TraceView::Impl::GetItemValues(size_t first, size_t count, const std::vector<TraceEventDataItem> &items, ItemValues::Impl &values) const
+{
+  auto view = Published();
+  const auto size = view->rows.Size();
+  const auto rows = first < size ? (std::min)(count, size - first) : 0;
+  const bool decode = std::any_of(items.begin(), items.end(), [](TraceEventDataItem item) { return !IsScratchValue(item); });
+  values.Reset(rows, items.size());
+  EventRef ev;
+  for(size_t i = 0; i < rows; ++i)
+  {
+    ev = view->store.At(view->rows[first + i], ev);
+    values.Hold(ev.chunk);
+    if(decode)
     {
-      continue;
+      owner_->EvaluateItem(ev);
+    }
+    for(auto item : items)
+    {
+      values.Add(owner_->store_.Value(ev, item), IsScratchValue(item));
     }
-    (*tei)[item] = itemValue(item);
   }
-  (*tei)[TraceEventDataItem::TimeStamp] = FormatFileTime(TIME_FORMAT, timeStamp);
-  //
-  InsertItem(std::move(tei));
+  return rows;
+}
+
+// Metadata is addressed by the indices readers know, those of the published
+// events
+void *TraceView::Impl::GetItemMetadata(size_t index)
+{
+  auto view = Published();
+  if (index >= view->rows.Size())
+  {
+    return nullptr;
+  }
+  return view->store.Metadata(view->rows[index]);
+}
+
+bool TraceView::Impl::SetItemMetadata(size_t index, void *metadata)
+{
+  auto view = Published();
+  if (index >= view->rows.Size())
+  {
+    return false;
+  }
+  view->store.SetMetadata(view->rows[index], metadata);
+  return true;
 }
 
 ////////////////////
@@ -812,6 +2067,7 @@ bool LogfileEnumerator::Start()
   }
   impl_->SetStartTime(traceFile.LogfileHeader.StartTime);
   ProcessTrace(&traceHandle, 1, NULL, NULL);
+  impl_->FlushNotifications();
   return true;
 }
 
@@ -902,6 +2158,7 @@ void LiveTraceEnumerator::Stop()
     processor_->join();
     processor_.reset();
   }
+  impl_->FlushNotifications();
 }
 
 const wchar_t *LiveTraceEnumerator::GetSessionName() const
@@ -911,32 +2168,6 @@ const wchar_t *LiveTraceEnumerator::GetSessionName() const
 
 /////////////////////////////////////
 
-template <class CharT>
-std::vector<CharT> ReadWholeFile(const fs::path &filePath)
-{
-  std::vector<CharT> data;
-  auto h = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
-  if (h == INVALID_HANDLE_VALUE)
-  {
-    return data;
-  }
-  auto fileSize = GetFileSize(h, nullptr);
-  if (fileSize == 0)
-  {
-    CloseHandle(h);
-    return data;
-  }
-  data.resize((fileSize + (sizeof(CharT) - 1)) / sizeof(CharT));
-  if (!ReadFile(h, &data[0], fileSize, &fileSize, nullptr))
-  {
-    CloseHandle(h);
-    data.clear();
-    return data;
-  }
-  CloseHandle(h);
-  return data;
-}
-
 TxtfileEnumerator::TxtfileEnumerator(const FormatDatabase &db, const fs::path &logPath)
   : TraceEnumerator(db)
   , logPath_(logPath)
@@ -967,7 +2198,6 @@ bool TxtfileEnumerator::Start()
     { "MESSAGE", (size_t)TraceEventDataItem::Message },
     { "LINE", (size_t)TraceEventDataItem::LineNumber }
   };
-  std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
   auto fileData = ReadWholeFile<char>(logPath_);
   if (fileData.empty())
   {
@@ -1001,7 +2231,7 @@ bool TxtfileEnumerator::Start()
       firstLine = false;
       continue;
     }
-    std::vector<std::wstring> witems((size_t)TraceEventDataItem::MAX_ITEM);
+    EventText witems;
     size_t i = 0;
     for (auto &&im : items)
     {
@@ -1009,11 +2239,12 @@ bool TxtfileEnumerator::Start()
       {
         break;
       }
-      witems[eventItemMapper.at(i++)] = converter.from_bytes(im);
+      AppendUtf8(witems[eventItemMapper.at(i++)], im.data(), im.size());
     }
-    auto tei = std::make_unique<TraceEventItem>(witems);
-    impl_->InsertItem(std::move(tei));
+    auto timeStamp = ParseFileTime(TIME_FORMAT, witems[(size_t)TraceEventDataItem::TimeStamp]);
+    impl_->InsertItem(timeStamp ? FileTimeToTicks(*timeStamp) : 0, std::move(witems));
   }
+  impl_->FlushNotifications();
   return true;
 }
 
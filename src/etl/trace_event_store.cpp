@@ -0,0 +1,748 @@
+#include "stdafx.h"
+#include <ampp/etl/trace_enumerator.h>
+#include <ampp/etl/time_util.h>
+#include "trace_event_store.h"
+#include "trace_format_data_impl.h"
+#include "trace_format_impl.h"
+#include "trace_util.h"
+#include "number_util.h"
+
+namespace etl
+{
+
+const wchar_t TIME_FORMAT[] = L"Y-M-D H:m:S.l";
+
+namespace
+{
+
+// Values computed from numeric columns are formatted into a small per-thread
+// ring, so a returned reference survives the next few lookups on that thread.
+// DetachedValue() keeps them for longer.
+std::wstring &ScratchValue()
+{
+  const size_t RingSize = 16;
+  thread_local std::array<std::wstring, RingSize> ring;
+  thread_local size_t next = 0;
+  auto &rv = ring[next++ % RingSize];
+  rv.clear();
+  return rv;
+}
+
+// Set in the byte count of a chunk once it left the store
+const size_t RetiredBytes = ~(~size_t(0) >> 1);
+
+const std::wstring &NumberValue(std::uint64_t v)
+{
+  auto &rv = ScratchValue();
+  AppendDecimal(rv, v);
+  return rv;
+}
+
+// A spilled chunk is stored as its row count followed by the process id,
+// thread id, trace id, payload length, file guid and state columns and the
+// payloads of all rows back to back
+template <class T>
+void WriteColumn(std::vector<std::uint8_t> &out, const T *values, size_t count)
+{
+  auto bytes = reinterpret_cast<const std::uint8_t *>(values);
+  out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+template <class T>
+void ReadColumn(const std::uint8_t *&in, std::vector<T> &column, size_t count)
+{
+  column.resize(count);
+  memcpy(column.data(), in, count * sizeof(T));
+  in += count * sizeof(T);
+}
+
+} // private namespace
+
+PayloadArena::PayloadArena(size_t maxBlocks)
+  : used_(BlockSize)
+  , bytes_(0)
+{
+  // every Add opens at most one block, so the block table never reallocates
+  // underneath a reader
+  blocks_.reserve(maxBlocks);
+}
+
+std::uint64_t PayloadArena::Add(const void *data, size_t length)
+{
+  if(length == 0)
+  {
+    return 0;
+  }
+  if(length > BlockSize - used_)
+  {
+    auto blockLength = (std::max)(length, BlockSize);
+    blocks_.emplace_back(new std::uint8_t[blockLength]);
+    bytes_ += blockLength;
+    used_ = 0;
+  }
+  const auto block = blocks_.size() - 1;
+  memcpy(blocks_[block].get() + used_, data, length);
+  const auto rv = static_cast<std::uint64_t>(block) * BlockSize + used_;
+  // a payload larger than a block gets a block of its own, the next one
+  // opens a new block
+  used_ = (std::min)(used_ + length, BlockSize);
+  return rv;
+}
+
+const std::uint8_t *PayloadArena::Data(std::uint64_t offset) const
+{
+  return blocks_[static_cast<size_t>(offset / BlockSize)].get() + offset % BlockSize;
+}
+
+size_t PayloadArena::Bytes() const
+{
+  return bytes_;
+}
+
+//////////////////////
+
+KeptValues::KeptValues()
+  : bytes_(0)
+{
+}
+
+const std::wstring &KeptValues::Keep(size_t offset, TraceEventDataItem item, const std::wstring &value, size_t *addedBytes)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  auto &kept = values_[offset * static_cast<size_t>(TraceEventDataItem::MAX_ITEM) + static_cast<size_t>(item)];
+  *addedBytes = 0;
+  if(!kept)
+  {
+    kept.reset(new std::wstring(value));
+    *addedBytes = kept->capacity() * sizeof(wchar_t) + sizeof(*kept);
+    bytes_ += *addedBytes;
+  }
+  return *kept;
+}
+
+size_t KeptValues::Bytes() const
+{
+  std::lock_guard<std::mutex> l(lock_);
+  return bytes_;
+}
+
+//////////////////////
+
+// column memory reserved for every row of a chunk
+const size_t RowBytes = sizeof(std::uint64_t) * 2 + sizeof(DWORD) * 3 + sizeof(std::uint32_t) + sizeof(GUID)
+  + sizeof(const TraceFormat *) + sizeof(DataState) + sizeof(void *) + sizeof(std::wstring);
+
+EventChunk::EventChunk(EventRow first, size_t reserve)
+  : firstRow(first)
+  , newestTimeStamp(0)
+  , payloads(reserve)
+  , kept(std::make_shared<KeptValues>())
+  , spillOffset(0)
+  , spillLength(0)
+  , bytes(reserve * RowBytes)
+{
+  timeStamps.reserve(reserve);
+  processIds.reserve(reserve);
+  threadIds.reserve(reserve);
+  traceIds.reserve(reserve);
+  fileGuids.reserve(reserve);
+  formats.reserve(reserve);
+  states.reset(new std::atomic<DataState>[reserve]());
+  metadata.reset(new std::atomic<void *>[reserve]());
+  payloadOffsets.reserve(reserve);
+  payloadLengths.reserve(reserve);
+  messages.reserve(reserve);
+}
+
+size_t EventChunk::Size() const
+{
+  return timeStamps.size();
+}
+
+bool EventChunk::Spilled() const
+{
+  return spillLength != 0;
+}
+
+// Once this returns true the message and format of the row can be read
+bool EventChunk::HasData(size_t offset) const
+{
+  return states[offset].load(std::memory_order_acquire) == DataState::HasData;
+}
+
+const std::uint8_t *EventChunk::Payload(size_t offset) const
+{
+  if(!payloadLengths[offset])
+  {
+    return nullptr;
+  }
+  return mapped ? mapped.get() + payloadOffsets[offset] : payloads.Data(payloadOffsets[offset]);
+}
+
+//////////////////////
+
+StoreView::StoreView()
+  : store_(nullptr)
+  , firstRow_(0)
+  , end_(0)
+{
+}
+
+// Whether the row was stored and not yet evicted when the view was taken
+bool StoreView::Contains(EventRow row) const
+{
+  return row >= firstRow_ && row < end_;
+}
+
+const std::shared_ptr<EventChunk> &StoreView::Chunk(EventRow row) const
+{
+  return chunks_->data()[static_cast<size_t>((row - firstRow_) / EventChunk::Capacity)];
+}
+
+EventRef StoreView::At(EventRow row) const
+{
+  return EventRef {store_->Load(Chunk(row)), static_cast<size_t>(row % EventChunk::Capacity), row};
+}
+
+EventRef StoreView::At(EventRow row, const EventRef &previous) const
+{
+  if(previous.chunk && row - previous.chunk->firstRow < EventChunk::Capacity)
+  {
+    return EventRef {previous.chunk, static_cast<size_t>(row - previous.chunk->firstRow), row};
+  }
+  return At(row);
+}
+
+// The last chunk may still be growing, its columns are read through data()
+std::uint64_t StoreView::TimeStamp(EventRow row) const
+{
+  return Chunk(row)->timeStamps.data()[static_cast<size_t>(row % EventChunk::Capacity)];
+}
+
+// Metadata stays in memory for spilled chunks too, a stub shares it with the
+// chunk it replaced
+void *StoreView::Metadata(EventRow row) const
+{
+  return Chunk(row)->metadata[static_cast<size_t>(row % EventChunk::Capacity)];
+}
+
+void StoreView::SetMetadata(EventRow row, void *metadata) const
+{
+  Chunk(row)->metadata[static_cast<size_t>(row % EventChunk::Capacity)] = metadata;
+}
+
+//////////////////////
+
+TraceEventStore::TraceEventStore(const FormatDatabase &db)
+  : db_(db)
+  , chunks_(std::make_shared<ChunkTable>())
+  , size_(0)
+  , firstRow_(0)
+  , bytes_(0)
+  , firstResident_(0)
+  , generation_(0)
+{
+}
+
+EventChunk &TraceEventStore::AppendRow(std::uint64_t timeStamp)
+{
+  if(chunks_->empty() || chunks_->back()->Size() == EventChunk::Capacity)
+  {
+    auto chunk = std::make_shared<EventChunk>(size_);
+    bytes_ += chunk->bytes;
+    Table(true).push_back(std::move(chunk));
+  }
+  auto &chunk = *chunks_->back();
+  chunk.timeStamps.push_back(timeStamp);
+  chunk.newestTimeStamp = (std::max)(chunk.newestTimeStamp, timeStamp);
+  chunk.messages.emplace_back();
+  ++size_;
+  return chunk;
+}
+
+EventRow TraceEventStore::Append(const GUID &fileGuid, DWORD traceIdx, std::uint64_t timeStamp, DWORD processId, DWORD threadId, const void *payload, size_t payloadLength)
+{
+  const auto row = size_;
+  auto &chunk = AppendRow(timeStamp);
+  chunk.processIds.push_back(processId);
+  chunk.threadIds.push_back(threadId);
+  chunk.traceIds.push_back(traceIdx);
+  chunk.fileGuids.push_back(fileGuid);
+  chunk.formats.push_back(nullptr);
+  const auto arenaBytes = chunk.payloads.Bytes();
+  chunk.payloadOffsets.push_back(chunk.payloads.Add(payload, payloadLength));
+  chunk.bytes += chunk.payloads.Bytes() - arenaBytes;
+  bytes_ += chunk.payloads.Bytes() - arenaBytes;
+  chunk.payloadLengths.push_back(static_cast<std::uint32_t>(payloadLength));
+  return row;
+}
+
+EventRow TraceEventStore::Append(std::uint64_t timeStamp, EventText &&text)
+{
+  const auto row = size_;
+  auto &chunk = AppendRow(timeStamp);
+  chunk.processIds.push_back(0);
+  chunk.threadIds.push_back(0);
+  chunk.traceIds.push_back(0);
+  chunk.fileGuids.push_back(GUID());
+  chunk.formats.push_back(nullptr);
+  chunk.payloadOffsets.push_back(0);
+  chunk.payloadLengths.push_back(0);
+  if(!chunk.texts)
+  {
+    chunk.texts = std::make_shared<EventTexts>(EventChunk::Capacity);
+  }
+  const auto offset = static_cast<size_t>(row % EventChunk::Capacity);
+  (*chunk.texts)[offset] = std::make_unique<EventText>(std::move(text));
+  chunk.states[offset] = DataState::HasData;
+  return row;
+}
+
+// One past the newest row, rows below FirstRow() have been evicted
+EventRow TraceEventStore::Size() const
+{
+  return size_;
+}
+
+EventRow TraceEventStore::FirstRow() const
+{
+  return firstRow_;
+}
+
+size_t TraceEventStore::Count() const
+{
+  return static_cast<size_t>(size_ - firstRow_);
+}
+
+size_t TraceEventStore::Bytes() const
+{
+  return bytes_;
+}
+
+size_t TraceEventStore::ChunkCount() const
+{
+  return chunks_->size();
+}
+
+// Changes with every Clear(), which numbers rows from 0 again
+size_t TraceEventStore::Generation() const
+{
+  return generation_;
+}
+
+// The newest time stamp in the oldest chunk, once it is too old so are all
+// of its rows
+std::uint64_t TraceEventStore::OldestChunkNewest() const
+{
+  return chunks_->empty() ? 0 : chunks_->front()->newestTimeStamp;
+}
+
+// The table to change. A view still holding it keeps its own copy, unless
+// the change only appends to it without growing past its capacity.
+ChunkTable &TraceEventStore::Table(bool append)
+{
+  if(chunks_.use_count() > 1 && !(append && chunks_->size() < chunks_->capacity()))
+  {
+    auto copy = std::make_shared<ChunkTable>();
+    copy->reserve(2 * chunks_->size() + 1);
+    copy->assign(chunks_->begin(), chunks_->end());
+    chunks_ = std::move(copy);
+  }
+  return *chunks_;
+}
+
+StoreView TraceEventStore::View() const
+{
+  StoreView view;
+  view.store_ = this;
+  view.chunks_ = chunks_;
+  view.firstRow_ = firstRow_;
+  view.end_ = size_;
+  return view;
+}
+
+// Drops the oldest chunk and returns the number of rows it held. Row numbers
+// of the remaining events do not change. The space a spilled chunk took in
+// the segment file is not reused.
+size_t TraceEventStore::EvictOldest()
+{
+  if(chunks_->empty())
+  {
+    return 0;
+  }
+  auto chunk = chunks_->front();
+  auto &table = Table(false);
+  table.erase(table.begin());
+  if(firstResident_)
+  {
+    --firstResident_;
+  }
+  const auto rows = chunk->Size();
+  const auto end = firstRow_ + rows;
+  if(chunk->Spilled())
+  {
+    std::lock_guard<std::mutex> l(pageLock_);
+    paged_.remove_if([&chunk](const std::shared_ptr<EventChunk> &c) { return c->firstRow == chunk->firstRow; });
+  }
+  Retire(std::move(chunk));
+  firstRow_ = end;
+  return rows;
+}
+
+// Moves the oldest resident chunk to the segment file and leaves a stub with
+// its time stamps and metadata in its place. Decoded messages are not kept,
+// they are formatted again once the chunk is paged back in.
+bool TraceEventStore::SpillOldest(const fs::path &directory)
+{
+  // the chunk being filled stays resident
+  if(firstResident_ + 1 >= chunks_->size() || !segment_.Open(directory))
+  {
+    return false;
+  }
+  auto chunk = (*chunks_)[firstResident_];
+  const auto rows = chunk->Size();
+  const auto rowCount = static_cast<std::uint32_t>(rows);
+  std::vector<std::uint8_t> record;
+  record.reserve(sizeof(rowCount) + rows * (sizeof(DWORD) * 3 + sizeof(std::uint32_t) + sizeof(GUID) + sizeof(DataState)) + chunk->payloads.Bytes());
+  WriteColumn(record, &rowCount, 1);
+  WriteColumn(record, chunk->processIds.data(), rows);
+  WriteColumn(record, chunk->threadIds.data(), rows);
+  WriteColumn(record, chunk->traceIds.data(), rows);
+  WriteColumn(record, chunk->payloadLengths.data(), rows);
+  WriteColumn(record, chunk->fileGuids.data(), rows);
+  for(size_t i = 0; i < rows; ++i)
+  {
+    const bool text = chunk->HasData(i) && !chunk->formats[i];
+    record.push_back(static_cast<std::uint8_t>(text ? DataState::HasData : DataState::NoData));
+  }
+  for(size_t i = 0; i < rows; ++i)
+  {
+    if(auto payload = chunk->Payload(i))
+    {
+      record.insert(record.end(), payload, payload + chunk->payloadLengths[i]);
+    }
+  }
+  auto stub = std::make_shared<EventChunk>(chunk->firstRow, 0);
+  if(!segment_.Append(record.data(), record.size(), &stub->spillOffset))
+  {
+    return false;
+  }
+  stub->spillLength = record.size();
+  stub->timeStamps = chunk->timeStamps;
+  stub->newestTimeStamp = chunk->newestTimeStamp;
+  stub->metadata = chunk->metadata;
+  stub->texts = chunk->texts;
+  stub->kept = chunk->kept;
+  stub->bytes = rows * (sizeof(std::uint64_t) + sizeof(void *)) + stub->kept->Bytes();
+  bytes_ += stub->bytes;
+  Table(false)[firstResident_] = std::move(stub);
+  Retire(std::move(chunk));
+  ++firstResident_;
+  return true;
+}
+
+void TraceEventStore::Clear()
+{
+  for(auto &&chunk : *chunks_)
+  {
+    chunk->bytes |= RetiredBytes;
+  }
+  chunks_ = std::make_shared<ChunkTable>();
+  size_ = 0;
+  firstRow_ = 0;
+  bytes_ = 0;
+  firstResident_ = 0;
+  ++generation_;
+  {
+    std::lock_guard<std::mutex> l(pageLock_);
+    paged_.clear();
+  }
+  segment_.Close();
+}
+
+void TraceEventStore::ResetUnresolved()
+{
+  auto reset = [](EventChunk &chunk)
+  {
+    const auto rows = chunk.Spilled() ? 0 : chunk.Size();
+    for(size_t i = 0; i < rows; ++i)
+    {
+      auto state = DataState::NoProvider;
+      chunk.states[i].compare_exchange_strong(state, DataState::NoData);
+    }
+  };
+  for(auto &&chunk : *chunks_)
+  {
+    reset(*chunk);
+  }
+  std::lock_guard<std::mutex> l(pageLock_);
+  for(auto &&chunk : paged_)
+  {
+    reset(*chunk);
+  }
+}
+
+// A chunk leaving the store lives on as long as a published view or a reader
+// holds it, references handed out for its rows stay valid until the views
+// have reported the change. Its bytes are no longer counted, neither are
+// values added to it from now on.
+void TraceEventStore::Retire(std::shared_ptr<EventChunk> &&chunk)
+{
+  bytes_ -= chunk->bytes.fetch_or(RetiredBytes) & ~RetiredBytes;
+  chunk.reset();
+}
+
+// Paged in copies are bounded by their cache and not counted
+void TraceEventStore::AddBytes(EventChunk &chunk, size_t bytes) const
+{
+  if(chunk.mapped || !bytes)
+  {
+    return;
+  }
+  bytes_ += bytes;
+  if(chunk.bytes.fetch_add(bytes) & RetiredBytes)
+  {
+    bytes_ -= bytes;
+  }
+}
+
+// Reads a spilled chunk back from the segment file. The payloads are used in
+// place from the mapped view, the most recently used chunks stay cached.
+std::shared_ptr<EventChunk> TraceEventStore::PageIn(const EventChunk &spilled) const
+{
+  const size_t PagedChunks = 16;
+  std::lock_guard<std::mutex> l(pageLock_);
+  auto it = std::find_if(paged_.begin(), paged_.end(), [&spilled](const std::shared_ptr<EventChunk> &c) { return c->firstRow == spilled.firstRow; });
+  if(it != paged_.end())
+  {
+    paged_.splice(paged_.begin(), paged_, it);
+    return paged_.front();
+  }
+  const auto rows = spilled.Size();
+  auto chunk = std::make_shared<EventChunk>(spilled.firstRow, 0);
+  chunk->timeStamps = spilled.timeStamps;
+  chunk->newestTimeStamp = spilled.newestTimeStamp;
+  chunk->formats.assign(rows, nullptr);
+  chunk->states.reset(new std::atomic<DataState>[rows]);
+  chunk->messages.resize(rows);
+  chunk->texts = spilled.texts;
+  chunk->kept = spilled.kept;
+  chunk->mapped = segment_.Map(spilled.spillOffset, spilled.spillLength);
+  if(chunk->mapped)
+  {
+    auto in = chunk->mapped.get() + sizeof(std::uint32_t);
+    ReadColumn(in, chunk->processIds, rows);
+    ReadColumn(in, chunk->threadIds, rows);
+    ReadColumn(in, chunk->traceIds, rows);
+    ReadColumn(in, chunk->payloadLengths, rows);
+    ReadColumn(in, chunk->fileGuids, rows);
+    for(size_t i = 0; i < rows; ++i)
+    {
+      chunk->states[i] = static_cast<DataState>(*in++);
+    }
+    chunk->payloadOffsets.resize(rows);
+    for(size_t i = 0; i < rows; ++i)
+    {
+      chunk->payloadOffsets[i] = in - chunk->mapped.get();
+      in += chunk->payloadLengths[i];
+    }
+  }
+  else
+  {
+    // an unreadable segment leaves the rows without data
+    chunk->processIds.assign(rows, 0);
+    chunk->threadIds.assign(rows, 0);
+    chunk->traceIds.assign(rows, 0);
+    chunk->payloadLengths.assign(rows, 0);
+    chunk->payloadOffsets.assign(rows, 0);
+    chunk->fileGuids.assign(rows, GUID());
+    for(size_t i = 0; i < rows; ++i)
+    {
+      chunk->states[i] = DataState::NoProvider;
+    }
+  }
+  paged_.push_front(chunk);
+  if(paged_.size() > PagedChunks)
+  {
+    paged_.pop_back();
+  }
+  return chunk;
+}
+
+// The chunk itself, or its paged in copy if it was spilled
+std::shared_ptr<EventChunk> TraceEventStore::Load(const std::shared_ptr<EventChunk> &chunk) const
+{
+  return chunk->Spilled() ? PageIn(*chunk) : chunk;
+}
+
+EventRef TraceEventStore::At(EventRow row) const
+{
+  return EventRef {Load((*chunks_)[static_cast<size_t>((row - firstRow_) / EventChunk::Capacity)]), static_cast<size_t>(row % EventChunk::Capacity), row};
+}
+
+// Same as At(row), but reuses the chunk of a previous lookup while the rows
+// stay within it
+EventRef TraceEventStore::At(EventRow row, const EventRef &previous) const
+{
+  if(previous.chunk && row - previous.chunk->firstRow < EventChunk::Capacity)
+  {
+    return EventRef {previous.chunk, static_cast<size_t>(row - previous.chunk->firstRow), row};
+  }
+  return At(row);
+}
+
+// The chunks from FirstRow() on. Holding them keeps the events readable
+// without the owner's lock, even if they are evicted meanwhile. Spilled ones
+// have to go through Load() before their events are read.
+std::vector<std::shared_ptr<EventChunk>> TraceEventStore::Chunks() const
+{
+  return *chunks_;
+}
+
+std::uint64_t TraceEventStore::TimeStamp(EventRow row) const
+{
+  return (*chunks_)[static_cast<size_t>((row - firstRow_) / EventChunk::Capacity)]->timeStamps[static_cast<size_t>(row % EventChunk::Capacity)];
+}
+
+bool TraceEventStore::Decode(const EventRef &ev) const
+{
+  auto &chunk = *ev.chunk;
+  auto &state = chunk.states[ev.offset];
+  for(;;)
+  {
+    auto current = state.load(std::memory_order_acquire);
+    if(current == DataState::HasData)
+    {
+      return true;
+    }
+    if(current == DataState::NoProvider)
+    {
+      return false;
+    }
+    if(current == DataState::NoData && state.compare_exchange_weak(current, DataState::Decoding))
+    {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  auto traceFmt = db_.FindTrace(chunk.fileGuids[ev.offset], chunk.traceIds[ev.offset]);
+  if(!traceFmt)
+  {
+    state.store(DataState::NoProvider, std::memory_order_release);
+    return false;
+  }
+  const size_t length = chunk.payloadLengths[ev.offset];
+  TraceFormatData fmtData {chunk.Payload(ev.offset), length};
+  chunk.messages[ev.offset] = FormatTraceFormat(*traceFmt, fmtData);
+  AddBytes(chunk, chunk.messages[ev.offset].capacity() * sizeof(wchar_t));
+  chunk.formats[ev.offset] = traceFmt;
+  state.store(DataState::HasData, std::memory_order_release);
+  return true;
+}
+
+// Resolves the trace site of a row without formatting its message
+const TraceFormat *TraceEventStore::Format(const EventRef &ev) const
+{
+  auto &chunk = *ev.chunk;
+  const auto state = chunk.states[ev.offset].load(std::memory_order_acquire);
+  if(state == DataState::HasData)
+  {
+    return chunk.formats[ev.offset];
+  }
+  if(state == DataState::NoProvider)
+  {
+    return nullptr;
+  }
+  return db_.FindTrace(chunk.fileGuids[ev.offset], chunk.traceIds[ev.offset]);
+}
+
+// Value() for readers that let go of the row right away. Numbers from the
+// scratch ring and messages, which a spilled chunk drops, are copied to the
+// kept values of the chunk once.
+const std::wstring &TraceEventStore::DetachedValue(const EventRef &ev, TraceEventDataItem item) const
+{
+  auto &value = Value(ev, item);
+  bool keep = false;
+  switch(item)
+  {
+  case TraceEventDataItem::TraceIndex:
+    keep = true;
+    break;
+  case TraceEventDataItem::TimeStamp:
+  case TraceEventDataItem::ProcessId:
+  case TraceEventDataItem::ThreadId:
+    keep = !IsText(ev);
+    break;
+  case TraceEventDataItem::Message:
+    // not before the row is decoded
+    keep = ev.chunk->HasData(ev.offset) && !IsText(ev);
+    break;
+  default:
+    break;
+  }
+  if(!keep)
+  {
+    return value;
+  }
+  size_t addedBytes;
+  auto &kept = ev.chunk->kept->Keep(ev.offset, item, value, &addedBytes);
+  AddBytes(*ev.chunk, addedBytes);
+  return kept;
+}
+
+bool TraceEventStore::IsText(const EventRef &ev) const
+{
+  return ev.chunk->HasData(ev.offset) && !ev.chunk->formats[ev.offset];
+}
+
+const std::wstring &TraceEventStore::Value(const EventRef &ev, TraceEventDataItem item) const
+{
+  static const std::wstring EmptyString;
+  const auto &chunk = *ev.chunk;
+  if(item == TraceEventDataItem::TraceIndex)
+  {
+    return NumberValue(ev.row);
+  }
+  const bool hasData = chunk.HasData(ev.offset);
+  auto traceFmt = hasData ? chunk.formats[ev.offset] : nullptr;
+  if(hasData && !traceFmt && chunk.texts)
+  {
+    if(auto &text = (*chunk.texts)[ev.offset])
+    {
+      return (*text)[static_cast<size_t>(item)];
+    }
+  }
+  switch(item)
+  {
+  case TraceEventDataItem::TimeStamp:
+    return ScratchValue() = FormatFileTime(TIME_FORMAT, TicksToFileTime(chunk.timeStamps[ev.offset]));
+  case TraceEventDataItem::ProcessId:
+    return NumberValue(chunk.processIds[ev.offset]);
+  case TraceEventDataItem::ThreadId:
+    return NumberValue(chunk.threadIds[ev.offset]);
+  case TraceEventDataItem::Message:
+    return hasData ? chunk.messages[ev.offset] : EmptyString;
+  default:
+    break;
+  }
+  if(!traceFmt)
+  {
+    return EmptyString;
+  }
+  switch(item)
+  {
+  case TraceEventDataItem::ModuleName:
+    return *traceFmt->site.moduleName;
+  case TraceEventDataItem::Function:
+    return *traceFmt->site.function;
+  case TraceEventDataItem::LineNumber:
+    return *traceFmt->site.lineNumber;
+  case TraceEventDataItem::SourceFile:
+    return *traceFmt->site.sourceFile;
+  default:
+    break;
+  }
+  return EmptyString;
+}
+
+} // namespace etl
@@ -0,0 +1,187 @@
+#pragma once
+#include <ampp/etl/trace_event_data.h>
+#include "segment_file.h"
+
+namespace etl
+{
+
+class FormatDatabase;
+struct TraceFormat;
+
+extern const wchar_t TIME_FORMAT[];
+
+// Decoding marks a row one thread is formatting, others wait for it
+enum class DataState : std::uint8_t
+{
+  NoData,
+  NoProvider,
+  HasData,
+  Decoding
+};
+
+// Rows are numbered in arrival order, the row number is also the TraceIndex.
+// Numbers are never reused, 64 bits do not wrap however long a session runs.
+using EventRow = std::uint64_t;
+
+// Field text for events that were injected or imported rather than decoded
+using EventText = std::array<std::wstring, static_cast<size_t>(TraceEventDataItem::MAX_ITEM)>;
+using EventTexts = std::vector<std::unique_ptr<EventText>>;
+
+// Raw payload bytes of one chunk, packed into large blocks that are only
+// released together with the arena. Offsets stay valid while it grows.
+class PayloadArena
+{
+public:
+  static const size_t BlockSize = 64 * 1024;
+  //
+  explicit PayloadArena(size_t maxBlocks);
+  std::uint64_t Add(const void *data, size_t length);
+  const std::uint8_t *Data(std::uint64_t offset) const;
+  size_t Bytes() const;
+private:
+  std::vector<std::unique_ptr<std::uint8_t[]>> blocks_;
+  size_t used_;
+  size_t bytes_;
+};
+
+// Values GetItemValue hands out by reference, copied on first access and
+// kept for as long as the rows. Shared by a chunk, its spill stub and paged
+// in copies.
+class KeptValues
+{
+public:
+  KeptValues();
+  const std::wstring &Keep(size_t offset, TraceEventDataItem item, const std::wstring &value, size_t *addedBytes);
+  size_t Bytes() const;
+private:
+  mutable std::mutex lock_;
+  std::unordered_map<size_t, std::unique_ptr<const std::wstring>> values_;
+  size_t bytes_;
+};
+
+// A fixed number of events stored column by column. The columns are reserved
+// up front so appending never moves existing values, and readers may use the
+// rows published to them while more are appended. After that only the state
+// and metadata of a row change, its message and format are written once by
+// the thread that moved the state to Decoding.
+// A spilled chunk only keeps its time stamps, metadata, texts and kept
+// values, the other columns are in the segment file and are read from a
+// mapped view of it when the chunk is paged in. The top bit of bytes is set
+// once the chunk left the store.
+struct EventChunk
+{
+  static const size_t Capacity = 8192;
+  //
+  EventRow firstRow;
+  std::vector<std::uint64_t> timeStamps;
+  // rows arrive out of order, the last one need not be the newest
+  std::uint64_t newestTimeStamp;
+  std::vector<DWORD> processIds;
+  std::vector<DWORD> threadIds;
+  std::vector<DWORD> traceIds;
+  std::vector<GUID> fileGuids;
+  std::vector<const TraceFormat *> formats;
+  std::unique_ptr<std::atomic<DataState>[]> states;
+  std::shared_ptr<std::atomic<void *>[]> metadata;
+  std::vector<std::uint64_t> payloadOffsets;
+  std::vector<std::uint32_t> payloadLengths;
+  PayloadArena payloads;
+  std::vector<std::wstring> messages;
+  std::shared_ptr<EventTexts> texts;
+  std::shared_ptr<KeptValues> kept;
+  std::shared_ptr<const std::uint8_t> mapped;
+  std::uint64_t spillOffset;
+  size_t spillLength;
+  std::atomic<size_t> bytes;
+  //
+  explicit EventChunk(EventRow first, size_t reserve = Capacity);
+  size_t Size() const;
+  bool Spilled() const;
+  bool HasData(size_t offset) const;
+  const std::uint8_t *Payload(size_t offset) const;
+};
+
+struct EventRef
+{
+  std::shared_ptr<EventChunk> chunk;
+  size_t offset;
+  EventRow row;
+};
+
+// Chunks from the first row on. Like a SequenceTable it is copied before
+// changes while a view shares it, only appending with room to spare is done
+// in place.
+using ChunkTable = std::vector<std::shared_ptr<EventChunk>>;
+
+class TraceEventStore;
+
+// The store as it was at one point in time, readable without the owner's
+// lock. Rows it holds stay readable even if they are evicted or spilled later.
+class StoreView
+{
+public:
+  StoreView();
+  bool Contains(EventRow row) const;
+  EventRef At(EventRow row) const;
+  EventRef At(EventRow row, const EventRef &previous) const;
+  std::uint64_t TimeStamp(EventRow row) const;
+  void *Metadata(EventRow row) const;
+  void SetMetadata(EventRow row, void *metadata) const;
+private:
+  friend class TraceEventStore;
+  const std::shared_ptr<EventChunk> &Chunk(EventRow row) const;
+private:
+  const TraceEventStore *store_;
+  std::shared_ptr<const ChunkTable> chunks_;
+  EventRow firstRow_;
+  EventRow end_;
+};
+
+class TraceEventStore
+{
+public:
+  explicit TraceEventStore(const FormatDatabase &db);
+  EventRow Append(const GUID &fileGuid, DWORD traceIdx, std::uint64_t timeStamp, DWORD processId, DWORD threadId, const void *payload, size_t payloadLength);
+  EventRow Append(std::uint64_t timeStamp, EventText &&text);
+  EventRow Size() const;
+  EventRow FirstRow() const;
+  size_t Count() const;
+  size_t Bytes() const;
+  size_t ChunkCount() const;
+  size_t Generation() const;
+  std::uint64_t OldestChunkNewest() const;
+  size_t EvictOldest();
+  bool SpillOldest(const fs::path &directory);
+  void Clear();
+  void ResetUnresolved();
+  EventRef At(EventRow row) const;
+  EventRef At(EventRow row, const EventRef &previous) const;
+  std::shared_ptr<EventChunk> Load(const std::shared_ptr<EventChunk> &chunk) const;
+  std::vector<std::shared_ptr<EventChunk>> Chunks() const;
+  StoreView View() const;
+  std::uint64_t TimeStamp(EventRow row) const;
+  bool Decode(const EventRef &ev) const;
+  const TraceFormat *Format(const EventRef &ev) const;
+  bool IsText(const EventRef &ev) const;
+  const std::wstring &Value(const EventRef &ev, TraceEventDataItem item) const;
+  const std::wstring &DetachedValue(const EventRef &ev, TraceEventDataItem item) const;
+private:
+  EventChunk &AppendRow(std::uint64_t timeStamp);
+  ChunkTable &Table(bool append);
+  std::shared_ptr<EventChunk> PageIn(const EventChunk &spilled) const;
+  void Retire(std::shared_ptr<EventChunk> &&chunk);
+  void AddBytes(EventChunk &chunk, size_t bytes) const;
+private:
+  const FormatDatabase &db_;
+  std::shared_ptr<ChunkTable> chunks_;
+  SegmentFile segment_;
+  mutable std::list<std::shared_ptr<EventChunk>> paged_;
+  mutable std::mutex pageLock_;
+  EventRow size_;
+  EventRow firstRow_;
+  mutable std::atomic<size_t> bytes_;
+  size_t firstResident_;
+  size_t generation_;
+};
+
+} // namespace etl
@@ -4,6 +4,15 @@
 namespace etl
 {
 
+TraceSite::TraceSite()
+  : moduleName(nullptr)
+  , function(nullptr)
+  , lineNumber(nullptr)
+  , sourceFile(nullptr)
+  , sourcePath(nullptr)
+{
+}
+
 TraceFormat::TraceFormat()
   : traceIndex(0)
   , lineNumber(0)
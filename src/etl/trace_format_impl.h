@@ -1,4 +1,5 @@
 #pragma once
+#include "number_util.h"
 
 namespace etl
 {
@@ -16,6 +17,35 @@ enum FILE_INFO_FLAGS {
   FIF_64BIT_TRACE = 0x01,
 };
 
+struct TraceFormat;
+struct TraceFormatData;
+struct FormatInstruction;
+
+using FormatHandler = void (*)(const FormatInstruction &, TraceFormatData &, std::wstring &);
+
+// One step of a compiled format string, either a literal span or an argument
+// with its type handler and printf spec already resolved.
+struct FormatInstruction
+{
+  FormatHandler handler;
+  std::wstring text;
+  std::wstring spec;
+  NumberFormat number;
+};
+
+// Strings shared by every event of a trace site. They point into the string
+// pool of the FormatDatabase that registered the format and live as long as it.
+struct TraceSite
+{
+  const std::wstring *moduleName;
+  const std::wstring *function;
+  const std::wstring *lineNumber;
+  const std::wstring *sourceFile;
+  const fs::path *sourcePath;
+  //
+  TraceSite();
+};
+
 struct TraceFormat
 {
   std::wstring moduleName;
@@ -28,6 +58,8 @@ struct TraceFormat
   DWORD traceLevel;
   DWORD flags;
   DWORD fileInfoFlags;
+  std::vector<FormatInstruction> program;
+  TraceSite site;
   //
   TraceFormat();
 };
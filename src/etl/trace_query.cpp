@@ -0,0 +1,631 @@
+#include "stdafx.h"
+#include <ampp/etl/time_util.h>
+#include <ampp/etl/string_util.h>
+#include "trace_query.h"
+#include "trace_format_impl.h"
+#include "text_index.h"
+
+namespace etl
+{
+
+enum class QueryField
+{
+  Index,
+  ProcessId,
+  ThreadId,
+  Time,
+  Line,
+  Level,
+  Module,
+  Function,
+  File,
+  Message
+};
+
+enum class QueryOp
+{
+  Equal,
+  NotEqual,
+  Less,
+  LessEqual,
+  Greater,
+  GreaterEqual,
+  Contains,
+  In
+};
+
+struct QueryNode
+{
+  enum class Kind
+  {
+    And,
+    Or,
+    Not,
+    Compare
+  };
+  Kind kind;
+  std::vector<QueryNode> children;
+  QueryField field;
+  QueryOp op;
+  std::uint64_t low;
+  std::uint64_t high;
+  std::wstring text;
+  int cost;
+};
+
+namespace
+{
+
+struct FieldInfo
+{
+  const wchar_t *name;
+  QueryField field;
+  TraceEventDataItem item;
+  bool numeric;
+  int cost;
+};
+
+// cost: 0 reads a column, 1 needs the trace site, 2 formats the message
+const FieldInfo Fields[] = {
+  {L"index", QueryField::Index, TraceEventDataItem::TraceIndex, true, 0},
+  {L"pid", QueryField::ProcessId, TraceEventDataItem::ProcessId, true, 0},
+  {L"tid", QueryField::ThreadId, TraceEventDataItem::ThreadId, true, 0},
+  {L"time", QueryField::Time, TraceEventDataItem::TimeStamp, true, 0},
+  {L"line", QueryField::Line, TraceEventDataItem::LineNumber, true, 1},
+  {L"level", QueryField::Level, TraceEventDataItem::MAX_ITEM, true, 1},
+  {L"module", QueryField::Module, TraceEventDataItem::ModuleName, false, 1},
+  {L"function", QueryField::Function, TraceEventDataItem::Function, false, 1},
+  {L"file", QueryField::File, TraceEventDataItem::SourceFile, false, 1},
+  {L"message", QueryField::Message, TraceEventDataItem::Message, false, 2},
+};
+
+const FieldInfo &GetFieldInfo(QueryField field)
+{
+  return Fields[static_cast<size_t>(field)];
+}
+
+enum class TokenType
+{
+  End,
+  Identifier,
+  Number,
+  String,
+  Operator,
+  Error
+};
+
+struct Token
+{
+  TokenType type;
+  std::wstring text;
+  size_t pos;
+};
+
+class QueryParser
+{
+public:
+  explicit QueryParser(const std::wstring &expression);
+  bool Parse(QueryNode &root);
+  const std::wstring &Error() const;
+private:
+  void Next();
+  bool Accept(const wchar_t *op);
+  bool Fail(const std::wstring &msg);
+  bool ParseOr(QueryNode &node);
+  bool ParseAnd(QueryNode &node);
+  bool ParseUnary(QueryNode &node);
+  bool ParseCompare(QueryNode &node);
+  bool ParseNumber(const FieldInfo &info, std::uint64_t &value);
+private:
+  const std::wstring &expr_;
+  size_t pos_;
+  Token token_;
+  std::wstring error_;
+};
+
+QueryParser::QueryParser(const std::wstring &expression)
+  : expr_(expression)
+  , pos_(0)
+{
+  Next();
+}
+
+const std::wstring &QueryParser::Error() const
+{
+  return error_;
+}
+
+bool QueryParser::Fail(const std::wstring &msg)
+{
+  if(error_.empty())
+  {
+    error_ = msg + L" at " + std::to_wstring(token_.pos);
+  }
+  return false;
+}
+
+void QueryParser::Next()
+{
+  while(pos_ < expr_.length() && IsWhite(expr_[pos_]))
+  {
+    ++pos_;
+  }
+  token_.pos = pos_;
+  token_.text.clear();
+  if(pos_ == expr_.length())
+  {
+    token_.type = TokenType::End;
+    return;
+  }
+  auto c = expr_[pos_];
+  if(iswalpha(c) || c == L'_')
+  {
+    token_.type = TokenType::Identifier;
+    while(pos_ < expr_.length() && (iswalnum(expr_[pos_]) || expr_[pos_] == L'_'))
+    {
+      token_.text += static_cast<wchar_t>(towlower(expr_[pos_++]));
+    }
+    return;
+  }
+  if(iswdigit(c))
+  {
+    token_.type = TokenType::Number;
+    while(pos_ < expr_.length() && iswalnum(expr_[pos_]))
+    {
+      token_.text += expr_[pos_++];
+    }
+    return;
+  }
+  if(c == L'"')
+  {
+    ++pos_;
+    while(pos_ < expr_.length() && expr_[pos_] != L'"')
+    {
+      if(expr_[pos_] == L'\\' && pos_ + 1 < expr_.length())
+      {
+        ++pos_;
+      }
+      token_.text += expr_[pos_++];
+    }
+    token_.type = pos_ < expr_.length() ? TokenType::String : TokenType::Error;
+    ++pos_;
+    return;
+  }
+  static const wchar_t *Operators[] = {L"&&", L"||", L"==", L"!=", L"<=", L">=", L"<", L">", L"!", L"~", L"(", L")", L"[", L"]", L","};
+  for(auto op : Operators)
+  {
+    if(expr_.compare(pos_, wcslen(op), op) == 0)
+    {
+      token_.type = TokenType::Operator;
+      token_.text = op;
+      pos_ += wcslen(op);
+      return;
+    }
+  }
+  token_.type = TokenType::Error;
+}
+
+bool QueryParser::Accept(const wchar_t *op)
+{
+  if(token_.type == TokenType::Operator && token_.text == op)
+  {
+    Next();
+    return true;
+  }
+  return false;
+}
+
+bool QueryParser::Parse(QueryNode &root)
+{
+  if(!ParseOr(root))
+  {
+    return false;
+  }
+  if(token_.type != TokenType::End)
+  {
+    return Fail(L"unexpected input");
+  }
+  return true;
+}
+
+// the cheapest operand goes first so && and || can skip the expensive ones
+void SortOperands(QueryNode &node)
+{
+  std::stable_sort(node.children.begin(), node.children.end(), [](const QueryNode &l, const QueryNode &r) { return l.cost < r.cost; });
+  node.cost = node.children.back().cost;
+}
+
+bool QueryParser::ParseOr(QueryNode &node)
+{
+  if(!ParseAnd(node))
+  {
+    return false;
+  }
+  if(token_.type != TokenType::Operator || token_.text != L"||")
+  {
+    return true;
+  }
+  QueryNode orNode {QueryNode::Kind::Or};
+  orNode.children.push_back(std::move(node));
+  while(Accept(L"||"))
+  {
+    orNode.children.emplace_back();
+    if(!ParseAnd(orNode.children.back()))
+    {
+      return false;
+    }
+  }
+  SortOperands(orNode);
+  node = std::move(orNode);
+  return true;
+}
+
+bool QueryParser::ParseAnd(QueryNode &node)
+{
+  if(!ParseUnary(node))
+  {
+    return false;
+  }
+  if(token_.type != TokenType::Operator || token_.text != L"&&")
+  {
+    return true;
+  }
+  QueryNode andNode {QueryNode::Kind::And};
+  andNode.children.push_back(std::move(node));
+  while(Accept(L"&&"))
+  {
+    andNode.children.emplace_back();
+    if(!ParseUnary(andNode.children.back()))
+    {
+      return false;
+    }
+  }
+  SortOperands(andNode);
+  node = std::move(andNode);
+  return true;
+}
+
+bool QueryParser::ParseUnary(QueryNode &node)
+{
+  if(Accept(L"!"))
+  {
+    node.kind = QueryNode::Kind::Not;
+    node.children.emplace_back();
+    if(!ParseUnary(node.children.back()))
+    {
+      return false;
+    }
+    node.cost = node.children.back().cost;
+    return true;
+  }
+  if(Accept(L"("))
+  {
+    if(!ParseOr(node))
+    {
+      return false;
+    }
+    return Accept(L")") || Fail(L"expected )");
+  }
+  return ParseCompare(node);
+}
+
+bool QueryParser::ParseNumber(const FieldInfo &info, std::uint64_t &value)
+{
+  if(token_.type == TokenType::String && info.field == QueryField::Time)
+  {
+    auto ft = ParseFileTime(TIME_FORMAT, token_.text);
+    if(!ft)
+    {
+      return Fail(L"bad time value");
+    }
+    value = FileTimeToTicks(*ft);
+    Next();
+    return true;
+  }
+  if(token_.type != TokenType::Number)
+  {
+    return Fail(L"expected a number");
+  }
+  const bool hex = token_.text.length() > 2 && token_.text[0] == L'0' && towlower(token_.text[1]) == L'x';
+  auto cur = token_.text.cbegin() + (hex ? 2 : 0);
+  if(!ParseInt(cur, token_.text.cend(), value, hex ? 16 : 10) || cur != token_.text.cend())
+  {
+    return Fail(L"bad number");
+  }
+  Next();
+  return true;
+}
+
+bool QueryParser::ParseCompare(QueryNode &node)
+{
+  if(token_.type != TokenType::Identifier)
+  {
+    return Fail(L"expected a field name");
+  }
+  auto info = std::find_if(std::begin(Fields), std::end(Fields), [this](const FieldInfo &fi) { return token_.text == fi.name; });
+  if(info == std::end(Fields))
+  {
+    return Fail(L"unknown field " + token_.text);
+  }
+  Next();
+  node.kind = QueryNode::Kind::Compare;
+  node.field = info->field;
+  node.cost = info->cost;
+  node.low = 0;
+  node.high = 0;
+  if(token_.type == TokenType::Identifier && token_.text == L"in")
+  {
+    if(!info->numeric)
+    {
+      return Fail(L"in needs a numeric field");
+    }
+    Next();
+    node.op = QueryOp::In;
+    return (Accept(L"[") || Fail(L"expected ["))
+      && ParseNumber(*info, node.low)
+      && (Accept(L",") || Fail(L"expected ,"))
+      && ParseNumber(*info, node.high)
+      && (Accept(L"]") || Fail(L"expected ]"));
+  }
+  static const std::pair<const wchar_t *, QueryOp> Ops[] = {
+    {L"==", QueryOp::Equal},
+    {L"!=", QueryOp::NotEqual},
+    {L"<=", QueryOp::LessEqual},
+    {L">=", QueryOp::GreaterEqual},
+    {L"<", QueryOp::Less},
+    {L">", QueryOp::Greater},
+    {L"~", QueryOp::Contains},
+  };
+  auto op = std::find_if(std::begin(Ops), std::end(Ops), [this](const std::pair<const wchar_t *, QueryOp> &o) { return token_.type == TokenType::Operator && token_.text == o.first; });
+  if(op == std::end(Ops))
+  {
+    return Fail(L"expected a comparison");
+  }
+  Next();
+  node.op = op->second;
+  if(info->numeric)
+  {
+    if(node.op == QueryOp::Contains)
+    {
+      return Fail(L"~ needs a text field");
+    }
+    return ParseNumber(*info, node.low);
+  }
+  if(node.op != QueryOp::Equal && node.op != QueryOp::NotEqual && node.op != QueryOp::Contains)
+  {
+    return Fail(L"text fields only support ==, != and ~");
+  }
+  if(token_.type != TokenType::String)
+  {
+    return Fail(L"expected a string");
+  }
+  node.text = token_.text;
+  if(node.op == QueryOp::Contains)
+  {
+    std::transform(node.text.begin(), node.text.end(), node.text.begin(), towlower);
+  }
+  Next();
+  return true;
+}
+
+//////////////////////
+
+bool CompareNumber(QueryOp op, std::uint64_t v, const QueryNode &node)
+{
+  switch(op)
+  {
+  case QueryOp::Equal:
+    return v == node.low;
+  case QueryOp::NotEqual:
+    return v != node.low;
+  case QueryOp::Less:
+    return v < node.low;
+  case QueryOp::LessEqual:
+    return v <= node.low;
+  case QueryOp::Greater:
+    return v > node.low;
+  case QueryOp::GreaterEqual:
+    return v >= node.low;
+  case QueryOp::In:
+    return v >= node.low && v <= node.high;
+  default:
+    return false;
+  }
+}
+
+// Reads the typed value of a field, resolving the trace site and formatting
+// the message only when the field needs them
+class RowReader
+{
+public:
+  RowReader(const TraceEventStore &store, const EventRef &ev);
+  bool Number(QueryField field, std::uint64_t &value);
+  const std::wstring &Text(QueryField field);
+private:
+  const TraceFormat *Format();
+private:
+  const TraceEventStore &store_;
+  const EventRef &ev_;
+  const TraceFormat *format_;
+  bool resolved_;
+  bool text_;
+};
+
+RowReader::RowReader(const TraceEventStore &store, const EventRef &ev)
+  : store_(store)
+  , ev_(ev)
+  , format_(nullptr)
+  , resolved_(false)
+  , text_(store.IsText(ev))
+{
+}
+
+const TraceFormat *RowReader::Format()
+{
+  if(!resolved_)
+  {
+    format_ = store_.Format(ev_);
+    resolved_ = true;
+  }
+  return format_;
+}
+
+bool RowReader::Number(QueryField field, std::uint64_t &value)
+{
+  auto &chunk = *ev_.chunk;
+  switch(field)
+  {
+  case QueryField::Index:
+    value = ev_.row;
+    return true;
+  case QueryField::Time:
+    value = chunk.timeStamps[ev_.offset];
+    return true;
+  default:
+    break;
+  }
+  if(text_)
+  {
+    // injected rows only carry text, numeric fields are parsed back from it
+    auto item = GetFieldInfo(field).item;
+    if(item == TraceEventDataItem::MAX_ITEM)
+    {
+      return false;
+    }
+    auto &s = store_.Value(ev_, item);
+    auto cur = s.cbegin();
+    return !s.empty() && ParseInt(cur, s.cend(), value, 10) && cur == s.cend();
+  }
+  switch(field)
+  {
+  case QueryField::ProcessId:
+    value = chunk.processIds[ev_.offset];
+    return true;
+  case QueryField::ThreadId:
+    value = chunk.threadIds[ev_.offset];
+    return true;
+  default:
+    break;
+  }
+  auto fmt = Format();
+  if(!fmt)
+  {
+    return false;
+  }
+  value = field == QueryField::Line ? fmt->lineNumber : fmt->traceLevel;
+  return true;
+}
+
+const std::wstring &RowReader::Text(QueryField field)
+{
+  static const std::wstring EmptyString;
+  if(field == QueryField::Message)
+  {
+    store_.Decode(ev_);
+    return store_.Value(ev_, TraceEventDataItem::Message);
+  }
+  if(text_)
+  {
+    return store_.Value(ev_, GetFieldInfo(field).item);
+  }
+  auto fmt = Format();
+  if(!fmt)
+  {
+    return EmptyString;
+  }
+  switch(field)
+  {
+  case QueryField::Module:
+    return *fmt->site.moduleName;
+  case QueryField::Function:
+    return *fmt->site.function;
+  case QueryField::File:
+    return *fmt->site.sourceFile;
+  default:
+    return EmptyString;
+  }
+}
+
+bool Evaluate(const QueryNode &node, RowReader &row)
+{
+  switch(node.kind)
+  {
+  case QueryNode::Kind::And:
+    for(auto &&child : node.children)
+    {
+      if(!Evaluate(child, row))
+      {
+        return false;
+      }
+    }
+    return true;
+  case QueryNode::Kind::Or:
+    for(auto &&child : node.children)
+    {
+      if(Evaluate(child, row))
+      {
+        return true;
+      }
+    }
+    return false;
+  case QueryNode::Kind::Not:
+    return !Evaluate(node.children.front(), row);
+  default:
+    break;
+  }
+  if(GetFieldInfo(node.field).numeric)
+  {
+    std::uint64_t v;
+    return row.Number(node.field, v) && CompareNumber(node.op, v, node);
+  }
+  auto &text = row.Text(node.field);
+  switch(node.op)
+  {
+  case QueryOp::Equal:
+    return text == node.text;
+  case QueryOp::NotEqual:
+    return text != node.text;
+  case QueryOp::Contains:
+    return ContainsText(text, node.text, false);
+  default:
+    return false;
+  }
+}
+
+} // private namespace
+
+TraceQuery::TraceQuery()
+{
+}
+
+TraceQuery::~TraceQuery()
+{
+}
+
+bool TraceQuery::Compile(const std::wstring &expression, std::wstring *error)
+{
+  auto root = std::make_unique<QueryNode>();
+  QueryParser parser(expression);
+  if(!parser.Parse(*root))
+  {
+    if(error)
+    {
+      *error = parser.Error();
+    }
+    return false;
+  }
+  root_ = std::move(root);
+  return true;
+}
+
+bool TraceQuery::Matches(const TraceEventStore &store, const EventRef &ev) const
+{
+  if(!root_)
+  {
+    return true;
+  }
+  RowReader row(store, ev);
+  return Evaluate(*root_, row);
+}
+
+} // namespace etl
@@ -0,0 +1,29 @@
+#pragma once
+#include "trace_event_store.h"
+
+namespace etl
+{
+
+struct QueryNode;
+
+// A filter expression compiled into typed predicates over the store columns.
+//
+//   pid == 4 && level <= 3 && message ~ "timeout" && time in ["2017-03-01 10:00", "2017-03-01 10:05"]
+//
+// Numeric fields are index, pid, tid, line, level and time, text fields are
+// module, function, file and message. Text compares with == and != or with
+// ~ for a case insensitive substring match. Terms combine with &&, || and !
+// and are evaluated cheapest first, so message formatting only happens for
+// rows the column predicates let through.
+class TraceQuery
+{
+public:
+  TraceQuery();
+  ~TraceQuery();
+  bool Compile(const std::wstring &expression, std::wstring *error);
+  bool Matches(const TraceEventStore &store, const EventRef &ev) const;
+private:
+  std::unique_ptr<QueryNode> root_;
+};
+
+} // namespace etl
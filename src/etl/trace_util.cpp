@@ -1,6 +1,7 @@
 #include "stdafx.h"
 
 #include <ampp/etl/string_util.h>
+#include <ampp/etl/status_message_table.h>
 #include "trace_util.h"
 #include "trace_format_impl.h"
 #include "trace_format_data_impl.h"
@@ -13,210 +14,257 @@ namespace
 {
 
 template<class T>
-std::wstring ToString(T v, const std::wstring &spec)
+void AppendPrintf(std::wstring &out, T v, const wchar_t *spec)
 {
-  std::wstring fmt = L"%";
-  fmt += spec;
   wchar_t tmp[40];
-  swprintf_s(tmp, fmt.c_str(), v);
-  return tmp;
+  auto len = swprintf_s(tmp, spec, v);
+  if(len > 0)
+  {
+    out.append(tmp, len);
+  }
+}
+
+void AppendText(const FormatInstruction &instr, TraceFormatData &, std::wstring &out)
+{
+  out += instr.text;
 }
 
-std::wstring GetErrorMessageString(DWORD s)
-{
-  LPWSTR msgBuf = nullptr;
-  DWORD langId = MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US); //MAKELANGID(LANG_NEUTRAL, SUBLANG_NEUTRAL);
-  auto len = FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_FROM_HMODULE | FORMAT_MESSAGE_IGNORE_INSERTS,
-                            GetModuleHandleW(L"ntdll.dll"),
-                            s,
-                            langId,
-                            reinterpret_cast<LPWSTR>(&msgBuf),
-                            0,
-                            NULL);
-  std::wstring rv;
-  if (msgBuf)
-  {
-    rv.assign(msgBuf, len);
-    LocalFree(msgBuf);
-    TrimR(rv);
-  }
-  else
-  {
-    rv = ToString(s, L"X");
+void AppendNtStatus(const FormatInstruction &, TraceFormatData &data, std::wstring &out)
+{
+  if(data.ValidFor(sizeof(NTSTATUS)))
+  {
+    out += StatusMessageTable::Default().Lookup(data.As<NTSTATUS>());
+  }
+  data.Advance(sizeof(NTSTATUS));
+}
+
+void AppendHResult(const FormatInstruction &, TraceFormatData &data, std::wstring &out)
+{
+  if(data.ValidFor(sizeof(HRESULT)))
+  {
+    out += StatusMessageTable::Default().Lookup(data.As<HRESULT>());
+  }
+  data.Advance(sizeof(HRESULT));
+}
+
+template <class T>
+void AppendInteger(const FormatInstruction &instr, TraceFormatData &data, std::wstring &out)
+{
+  if(!data.ValidFor(sizeof(T)))
+  {
+    return;
+  }
+  AppendSigned(out, data.As<T>(), sizeof(T), instr.number);
+  data.Advance(sizeof(T));
+}
+
+// Fallback for specs the integer kernels do not cover, e.g. "c" or "s"
+template <class T>
+void AppendIntegerPrintf(const FormatInstruction &instr, TraceFormatData &data, std::wstring &out)
+{
+  if(!data.ValidFor(sizeof(T)))
+  {
+    return;
+  }
+  AppendPrintf(out, data.As<T>(), instr.spec.c_str());
+  data.Advance(sizeof(T));
+}
+
+void AppendString(const FormatInstruction &, TraceFormatData &data, std::wstring &out)
+{
+  if(data.ValidFor(sizeof(char)))
+  {
+    auto str = static_cast<const char *>(data.data);
+    auto terminator = static_cast<const char *>(memchr(str, 0, data.length));
+    auto len = terminator ? static_cast<size_t>(terminator - str) : data.length;
+    AppendUtf8(out, str, len);
+    data.Advance(len + 1);
+  }
+}
+
+void AppendWString(const FormatInstruction &, TraceFormatData &data, std::wstring &out)
+{
+  if(data.ValidFor(sizeof(wchar_t)))
+  {
+    auto str = static_cast<wchar_t *>(data.data);
+    auto len = wcslen(str);
+    auto actualLen = __min(len, data.length);
+    out.append(str, actualLen);
+    data.Advance(actualLen + 1);
+  }
+}
+
+void AppendPWString(const FormatInstruction &, TraceFormatData &data, std::wstring &out)
+{
+  if(data.ValidFor(sizeof(wchar_t)))
+  {
+    auto str = static_cast<wchar_t *>(data.data);
+    auto len = *str++;
+    auto actualLen = __min(len, data.length) / sizeof(wchar_t);
+    out.append(str, actualLen);
+    data.Advance((1 + actualLen) * sizeof(wchar_t));
+  }
+}
+
+template <class T>
+void AppendPtr(const FormatInstruction &, TraceFormatData &data, std::wstring &out)
+{
+  if(data.ValidFor(sizeof(T)))
+  {
+    AppendHex(out, data.As<T>(), sizeof(T) * 2, true);
+    data.Advance(sizeof(T));
   }
-  return rv;
 }
 
-bool InsertTraceData(const std::wstring &type, const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-{
-  static const std::map<std::wstring, std::function<void (const TraceFormat &, TraceFormatData &, const std::wstring &, std::wstring &)>> mappers {
-    {L"FUNC", [](const TraceFormat &fmt, TraceFormatData &, const std::wstring &, std::wstring &out)
-              {
-                out += fmt.function;
-              }
-    },
-    { L"LINE", [](const TraceFormat &fmt, TraceFormatData &, const std::wstring &, std::wstring &out)
-              {
-                out += std::to_wstring(fmt.lineNumber);
-              }
-    },
-    {L"ItemNTSTATUS", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &, std::wstring &out)
-              {
-                out += data.ValidFor(sizeof(NTSTATUS)) ? GetErrorMessageString(data.As<NTSTATUS>()) : L"";
-                data.Advance(sizeof(NTSTATUS));
-              }
-    },
-    { L"ItemHRESULT", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &, std::wstring &out)
-              {
-                out += data.ValidFor(sizeof(HRESULT)) ? GetErrorMessageString(data.As<HRESULT>()) : L"";
-                data.Advance(sizeof(HRESULT));
-              }
-    },
-    {L"ItemLong", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-              {
-                if(!data.ValidFor(sizeof(LONG)))
-                {
-                  return;
-                }
-                out += ToString(data.As<LONG>(), typeExtra);
-                data.Advance(sizeof(LONG));
-              }
-    },
-    {L"ItemLongLongX", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-              {
-                if(!data.ValidFor(sizeof(LONGLONG)))
-                {
-                  return;
-                }
-                out += ToString(data.As<LONGLONG>(), typeExtra);
-                data.Advance(sizeof(LONGLONG));
-              }
-    },
-    {L"ItemULongLong", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-              {
-                if(!data.ValidFor(sizeof(LONGLONG)))
-                {
-                  return;
-                }
-                out += ToString(data.As<LONGLONG>(), typeExtra);
-                data.Advance(sizeof(LONGLONG));
-              }
-    },
-    {L"ItemString", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-              {
-                if(data.ValidFor(sizeof(char)))
-                {
-                  auto str = static_cast<char *>(data.data);
-                  auto len = strlen(str);
-                  auto actualLen = __min(len, data.length);
-                  std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-                  out += converter.from_bytes(str);
-                  data.Advance(actualLen + 1);
-                }
-              }
-    },
-    {L"ItemWString", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-              {
-                if(data.ValidFor(sizeof(wchar_t)))
-                {
-                  auto str = static_cast<wchar_t *>(data.data);
-                  auto len = wcslen(str);
-                  auto actualLen = __min(len, data.length);
-                  out.append(str, actualLen);
-                  data.Advance(actualLen + 1);
-                }
-              }
-    },
-    {L"ItemPWString", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-              {
-                if(data.ValidFor(sizeof(wchar_t)))
-                {
-                  auto str = static_cast<wchar_t *>(data.data);
-                  auto len = *str++;
-                  auto actualLen = __min(len, data.length) / sizeof(wchar_t);
-                  out.append(str, actualLen);
-                  data.Advance((1 + actualLen) * sizeof(wchar_t));
-                }
-              }
-    },
-    {L"ItemPtr", [](const TraceFormat &fmt, TraceFormatData &data, const std::wstring &typeExtra, std::wstring &out)
-              {
-                const auto ptrSize = (fmt.fileInfoFlags & FIF_64BIT_TRACE) != 0 ? 8 : 4;
-                if(data.ValidFor(ptrSize))
-                {
-                  std::wstringstream fmtTxt;
-                  fmtTxt << L"0" << (ptrSize * 2) << L"X";
-                  if ((fmt.fileInfoFlags & FIF_64BIT_TRACE) != 0)
-                  {
-                    out += ToString(data.As<DWORD64>(), fmtTxt.str());
-                  }
-                  else
-                  {
-                    out += ToString(data.As<DWORD>(), fmtTxt.str());
-                  }
-                  data.Advance(ptrSize);
-                }
-              }
-    },
+void AddText(std::vector<FormatInstruction> &program, const std::wstring &text)
+{
+  if(text.empty())
+  {
+    return;
+  }
+  if(!program.empty() && program.back().handler == AppendText)
+  {
+    program.back().text += text;
+    return;
+  }
+  program.push_back({AppendText, text, L"", NumberFormat()});
+}
+
+bool AddArgument(std::vector<FormatInstruction> &program, const std::wstring &type, const TraceFormat &fmt, const std::wstring &typeExtra)
+{
+  struct Handlers
+  {
+    FormatHandler kernel;
+    FormatHandler fallback;
+  };
+  static const std::map<std::wstring, Handlers> handlers {
+    {L"ItemNTSTATUS", {AppendNtStatus}},
+    {L"ItemHRESULT", {AppendHResult}},
+    {L"ItemLong", {AppendInteger<LONG>, AppendIntegerPrintf<LONG>}},
+    {L"ItemLongLongX", {AppendInteger<LONGLONG>, AppendIntegerPrintf<LONGLONG>}},
+    {L"ItemULongLong", {AppendInteger<LONGLONG>, AppendIntegerPrintf<LONGLONG>}},
+    {L"ItemString", {AppendString}},
+    {L"ItemWString", {AppendWString}},
+    {L"ItemPWString", {AppendPWString}},
   };
-  auto it = mappers.find(type);
-  if(it == mappers.end())
+  // FUNC and LINE only depend on the trace site, so they fold into the literal text
+  if(type == L"FUNC")
+  {
+    AddText(program, fmt.function);
+    return true;
+  }
+  if(type == L"LINE")
+  {
+    AddText(program, std::to_wstring(fmt.lineNumber));
+    return true;
+  }
+  if(type == L"ItemPtr")
+  {
+    if((fmt.fileInfoFlags & FIF_64BIT_TRACE) != 0)
+    {
+      program.push_back({AppendPtr<DWORD64>, L"", L"", NumberFormat()});
+    }
+    else
+    {
+      program.push_back({AppendPtr<DWORD>, L"", L"", NumberFormat()});
+    }
+    return true;
+  }
+  auto it = handlers.find(type);
+  if(it == handlers.end())
   {
     std::wcerr << L"NO MAPPER FOR: " << type << std::endl;
     return false;
   }
-  it->second(fmt, data, typeExtra, out);
+  FormatInstruction instr {it->second.kernel, L"", L"%" + typeExtra, NumberFormat()};
+  if(it->second.fallback && !ParseNumberFormat(typeExtra, instr.number))
+  {
+    instr.handler = it->second.fallback;
+  }
+  program.push_back(std::move(instr));
   return true;
 }
 
 } // private namespace
 
 
-std::wstring FormatTraceFormat(const TraceFormat &fmt, TraceFormatData data)
+std::vector<FormatInstruction> CompileTraceFormat(const TraceFormat &fmt)
 {
-  std::wstring rv;
+  std::vector<FormatInstruction> program;
+  std::wstring text;
   auto cur = fmt.formatString.cbegin();
   auto end = fmt.formatString.cend();
-  DWORD tmpIdx;
+  DWORD tmpIdx = 0;
   while(cur != end)
   {
+    if(*cur != L'%')
+    {
+      auto literal = std::find(cur, end, L'%');
+      text.append(cur, literal);
+      cur = literal;
+      continue;
+    }
+    ++cur;
+    if(cur == end)
+    {
+      break;
+    }
     if(*cur == L'%')
+    {
+      text += *cur++;
+      continue;
+    }
+    AddText(program, text);
+    text.clear();
+    if(*cur == L'!')
     {
       ++cur;
-      if(*cur == L'!')
+      auto type = CopyUntil(cur, end, L'!');
+      if(cur != end)
+      {
+        ++cur;
+      }
+      AddArgument(program, type, fmt, L"");
+    }
+    else
+    {
+      ParseInt(cur, end, tmpIdx, 10);
+      std::wstring typeExtra;
+      if(cur != end && *cur == L'!')
       {
         ++cur;
-        auto type = CopyUntil(cur, end, L'!');
+        typeExtra = CopyUntil(cur, end, L'!');
         if(cur != end)
         {
           ++cur;
         }
-        InsertTraceData(type, fmt, data, L"", rv);
       }
-      else
+      auto typeInfo = fmt.typeMap.find(tmpIdx);
+      if(typeInfo != fmt.typeMap.end())
       {
-        ParseInt(cur, end, tmpIdx, 10);
-        std::wstring typeExtra;
-        if(*cur == L'!')
-        {
-          ++cur;
-          typeExtra = CopyUntil(cur, end, L'!');
-          if(cur != end)
-          {
-            ++cur;
-          }
-        }
-        auto typeInfo = fmt.typeMap.find(tmpIdx);
-        if(typeInfo != fmt.typeMap.end())
-        {
-          InsertTraceData(typeInfo->second.type, fmt, data, typeExtra, rv);
-        }
+        AddArgument(program, typeInfo->second.type, fmt, typeExtra);
       }
     }
-    else
+  }
+  AddText(program, text);
+  return program;
+}
+
+std::wstring FormatTraceFormat(const TraceFormat &fmt, TraceFormatData data)
+{
+  std::wstring rv;
+  if(fmt.program.empty() && !fmt.formatString.empty())
+  {
+    // not registered through a FormatDatabase, compile for this call only
+    for(auto &&instr : CompileTraceFormat(fmt))
     {
-      rv += *cur++;
+      instr.handler(instr, data, rv);
     }
+    return rv;
+  }
+  for(auto &&instr : fmt.program)
+  {
+    instr.handler(instr, data, rv);
   }
   return rv;
 }
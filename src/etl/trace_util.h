@@ -5,7 +5,9 @@ namespace etl
 
 struct TraceFormat;
 struct TraceFormatData;
+struct FormatInstruction;
 
+std::vector<FormatInstruction> CompileTraceFormat(const TraceFormat &fmt);
 std::wstring FormatTraceFormat(const TraceFormat &fmt, TraceFormatData data);
 
 } // namespace etl